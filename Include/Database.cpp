@@ -1,7 +1,6 @@
 #include "../pch.h"
 #include "Database.h"
 std::int32_t nl::sql_extension_func_aggregate::sTextEncoding = SQLITE_UTF8;
-size_t nl::database::index_counter = 0;
 
 
 nl::database::database()
@@ -9,86 +8,118 @@ nl::database::database()
 	
 }
 
-nl::database::database(const std::string_view& database_file)
+nl::database::database(const std::string_view& database_file, const database_options& options)
 :m_database_conn(nullptr){
-	if (database_file.empty()){
-		if (sqlite3_open(nullptr, &m_database_conn) == SQLITE_ERROR){
-			throw std::exception("FATAL DATABASE ERROR: CANNOT OPEN MEMORY DATABASE");
-		}
-	}else{
-		if (sqlite3_open(database_file.data(), &m_database_conn) == SQLITE_ERROR){
-			throw std::exception("FATAL DATABASE ERROR: CANNOT OPEN DATABASE FILE");
-		}
+	if (!open_connection(std::string(database_file), options)){
+		throw std::exception(database_file.empty() ? "FATAL DATABASE ERROR: CANNOT OPEN MEMORY DATABASE"
+			: "FATAL DATABASE ERROR: CANNOT OPEN DATABASE FILE");
 	}
 	//create a begin, begin_immediate, end and rollback statments, 0, 1, 2 and 3 in the m_statments table
-	query q;
-	prepare_query(q.begin());
-	prepare_query(q.clear().begin_immediate());
-	prepare_query(q.clear().end());
-	prepare_query(q.clear().roll_back());
+	prepare_predefined_statements();
 
 }
 
-nl::database::database(const std::filesystem::path& database_file)
+nl::database::database(const std::filesystem::path& database_file, const database_options& options)
 {
-	if(sqlite3_open(database_file.string().data(), &m_database_conn) == SQLITE_ERROR){
+	if (!open_connection(database_file.string(), options)){
 		throw std::exception("FATAL DATABASE ERROR: CANNOT OPEN DATABASE FILE");
 	}
 	//create a begin, begin_immediate, end and rollback statments, 0, 1, 2 and 3 in the m_statments table
-	query q;
-	prepare_query(q.begin());
-	prepare_query(q.clear().begin_immediate());
-	prepare_query(q.clear().end());
-	prepare_query(q.clear().roll_back());
+	prepare_predefined_statements();
 }
 
 
 
 
-nl::database::database(const database&& connection) noexcept
+nl::database::database(database&& connection) noexcept
 {
-	if (m_database_conn != nullptr){
-		sqlite3_close(m_database_conn);
-	}
-	m_database_conn = std::move(connection.m_database_conn);
-	m_statements = std::move(connection.m_statements);
-	m_error_msg = std::move(connection.m_error_msg);
+	take_connection(connection);
 }
 
-nl::database& nl::database::operator=(const database&& connection) noexcept
+nl::database& nl::database::operator=(database&& connection) noexcept
 {
-	// TODO: insert return statement here
+	//the feed's hooks are on the connection about to be closed
+	assert(m_change_feed == nullptr && "Destroy the change_feed before assigning over its database");
+	if (this == &connection) return (*this);
 	if (m_database_conn != nullptr){
+		for (auto& entry : m_statements){
+			sqlite3_finalize(entry.statement);
+		}
 		sqlite3_close(m_database_conn);
 	}
-	m_database_conn = std::move(connection.m_database_conn);
+	take_connection(connection);
+	return (*this);
+}
+
+void nl::database::take_connection(database& connection)
+{
+	m_database_conn = connection.m_database_conn;
 	m_statements = std::move(connection.m_statements);
+	m_free_slots = std::move(connection.m_free_slots);
+	m_statement_slots = std::move(connection.m_statement_slots);
 	m_error_msg = std::move(connection.m_error_msg);
-	return (*this);
+	m_query_cache = std::move(connection.m_query_cache);
+	m_lru = std::move(connection.m_lru);
+	m_cache_capacity = connection.m_cache_capacity;
+	m_cache_stats = connection.m_cache_stats;
+	m_transaction_depth = connection.m_transaction_depth;
+	m_progress_callback = connection.m_progress_callback;
+	m_progress_data = connection.m_progress_data;
+	m_progress_frequency = connection.m_progress_frequency;
+	m_deadline = connection.m_deadline;
+	m_deadline_steps = connection.m_deadline_steps;
+	m_deadline_active = connection.m_deadline_active;
+	m_timed_out = connection.m_timed_out;
+	m_profiling = false;
+	//the feed's hooks point at the feed itself so they carry over with the connection, only its database changes
+	m_change_feed = connection.m_change_feed;
+	if (m_change_feed) m_change_feed->m_database = this;
+
+	//the profile callback and the deadline handler were registered with the address of the other database
+	if (connection.m_profiling) set_profiling(true);
+	if (m_deadline_active) sqlite3_progress_handler(m_database_conn, m_deadline_steps, &database::deadline_progress, this);
+
+	connection.m_database_conn = nullptr;
+	connection.m_statements.clear();
+	connection.m_free_slots.clear();
+	connection.m_statement_slots.clear();
+	connection.m_query_cache.clear();
+	connection.m_lru.clear();
+	connection.m_change_feed = nullptr;
+	connection.m_profiling = false;
+	connection.m_deadline_active = false;
+	connection.m_transaction_depth = 0;
 }
 
-void nl::database::open(const std::filesystem::path& database_file)
+void nl::database::open(const std::filesystem::path& database_file, const database_options& options)
 {
 	if (m_database_conn != nullptr) {
+		for (auto& entry : m_statements){
+			sqlite3_finalize(entry.statement);
+		}
 		sqlite3_close(m_database_conn);
+		m_database_conn = nullptr;
 	}
-	if (sqlite3_open(database_file.string().data(), &m_database_conn) == SQLITE_ERROR) {
+	if (!open_connection(database_file.string(), options)) {
 			throw std::exception("FATAL DATABASE ERROR: CANNOT OPEN DATABASE FILE");
 	}
 	//create a begin, begin_immediate, end and rollback statments, 0, 1, 2 and 3 in the m_statments table
 	m_statements.clear();
-	query q;
-	prepare_query(q.begin());
-	prepare_query(q.clear().begin_immediate());
-	prepare_query(q.clear().end());
-	prepare_query(q.clear().roll_back());
+	m_free_slots.clear();
+	m_statement_slots.clear();
+	m_profiling = false;
+	m_query_cache.clear();
+	m_lru.clear();
+	m_transaction_depth = 0;
+	prepare_predefined_statements();
 }
 
 nl::database::~database()
 {
 	if (!m_statements.empty()) {
-		for (auto& stmt : m_statements){
-			sqlite3_finalize((stmt.second));
+		for (auto& entry : m_statements){
+			//free slots hold nullptr, sqlite3_finalize ignores it
+			sqlite3_finalize(entry.statement);
 		}
 	}
 	if (m_database_conn){
@@ -99,6 +130,81 @@ nl::database::~database()
 nl::database::statement_index nl::database::prepare_query(const std::string& query)
 {
 	assert(!query.empty() && "Prepare query is empty");
+	if (m_cache_capacity == 0) return prepare_statement(query);
+	auto cached = m_query_cache.find(query);
+	if (cached != m_query_cache.end()){
+		m_cache_stats.hits++;
+		m_lru.splice(m_lru.begin(), m_lru, cached->second.lru_position);
+		return cached->second.index;
+	}
+	m_cache_stats.misses++;
+	const statement_index index = prepare_statement(query);
+	if (index == BADSTMT) return BADSTMT;
+
+	m_statements[slot_of(index)].query_text = query;
+	m_lru.push_front(index);
+	m_query_cache.insert({ query, cache_entry{ index, m_lru.begin() } });
+	evict_statements();
+	return index;
+}
+
+void nl::database::set_statement_cache_capacity(size_t capacity)
+{
+	m_cache_capacity = capacity;
+	if (m_cache_capacity == 0){
+		//the indices handed out stay valid, the statements just stop being shared
+		for (const statement_index index : m_lru){
+			statement_entry* entry = find_statement(index);
+			if (entry != nullptr) entry->query_text.clear();
+		}
+		m_query_cache.clear();
+		m_lru.clear();
+		return;
+	}
+	evict_statements();
+}
+
+void nl::database::evict_statements()
+{
+	auto it = m_lru.end();
+	while (m_lru.size() > m_cache_capacity && it != m_lru.begin()){
+		auto victim = std::prev(it);
+		statement_entry* entry = find_statement(*victim);
+		if (entry == nullptr || slot_of(*victim) < stmt::predefined_count){
+			m_lru.erase(victim);
+			continue;
+		}
+		//a cursor is reading it or a step left it unreset, finalizing it would pull it out from under the caller
+		if (entry->pins != 0 || sqlite3_stmt_busy(entry->statement)){
+			it = victim;
+			continue;
+		}
+		m_cache_stats.evictions++;
+		remove_statement(*victim);
+	}
+}
+
+void nl::database::pin_statement(statement_type statement, bool pin)
+{
+	auto slot = m_statement_slots.find(statement);
+	if (slot == m_statement_slots.end()) return;
+	size_t& pins = m_statements[slot->second].pins;
+	if (pin) pins++;
+	else if (pins != 0) pins--;
+}
+
+void nl::database::prepare_predefined_statements()
+{
+	//not in the query cache so they are never evicted
+	query q;
+	prepare_statement(q.begin().get_query());
+	prepare_statement(q.clear().begin_immediate().get_query());
+	prepare_statement(q.clear().end().get_query());
+	prepare_statement(q.clear().roll_back().get_query());
+}
+
+nl::database::statement_index nl::database::prepare_statement(const std::string& query)
+{
 	if (!sqlite3_complete(query.c_str())){
 		m_error_msg = std::string(sqlite3_errmsg(m_database_conn));
 		return BADSTMT;
@@ -106,16 +212,19 @@ nl::database::statement_index nl::database::prepare_query(const std::string& que
 	statement_type statement;
 	const char* tail = nullptr;
 	if ((sqlite3_prepare_v2(m_database_conn, query.data(), query.size(), &statement, &tail)) == SQLITE_OK){
-		size_t index = index_counter++; //forever increasing index_counter
-		auto [iter, inserted] = m_statements.insert({ index, statement });
-		if (inserted){
-			return iter->first;
+		//reuse a freed slot before growing, the slot keeps its generation so old indices to it stay stale
+		std::uint32_t slot = 0;
+		if (!m_free_slots.empty()){
+			slot = m_free_slots.back();
+			m_free_slots.pop_back();
 		}
 		else{
-			m_error_msg = "Could not create query statement, query handle already exist";
-			sqlite3_finalize(statement);
-			return BADSTMT;
+			slot = static_cast<std::uint32_t>(m_statements.size());
+			m_statements.emplace_back();
 		}
+		m_statements[slot].statement = statement;
+		m_statement_slots[statement] = slot;
+		return make_index(slot, m_statements[slot].generation);
 	}
 	m_error_msg = std::string(sqlite3_errmsg(m_database_conn));
 	return BADSTMT;
@@ -128,10 +237,27 @@ nl::database::statement_index nl::database::prepare_query(const nl::query& query
 
 void nl::database::remove_statement(nl::database::statement_index index)
 {
-	auto iter = m_statements.find(index);
-	if (iter != m_statements.end()) {
-		sqlite3_finalize(iter->second);
-		m_statements.erase(iter);
+	//begin_operation and end_operation step these slots directly, a user statement must never land in them
+	if (slot_of(index) < stmt::predefined_count){
+		m_error_msg = "The predefined transaction statements cannot be removed";
+		return;
+	}
+	statement_entry* entry = find_statement(index);
+	if (entry != nullptr) {
+		if (!entry->query_text.empty()){
+			auto cached = m_query_cache.find(entry->query_text);
+			if (cached != m_query_cache.end()){
+				m_lru.erase(cached->second.lru_position);
+				m_query_cache.erase(cached);
+			}
+		}
+		m_statement_slots.erase(entry->statement);
+		sqlite3_finalize(entry->statement);
+		//bumping the generation makes every index still pointing at this slot stale
+		const std::uint32_t generation = entry->generation + 1;
+		*entry = statement_entry{};
+		entry->generation = generation;
+		m_free_slots.push_back(slot_of(index));
 	}
 }
 
@@ -142,7 +268,10 @@ void nl::database::set_commit_handler(commit_callback callback, void* UserData)
 
 bool nl::database::set_trace_handler(trace_callback callback, std::uint32_t mask, void* UserData)
 {
-	return (sqlite3_trace_v2(m_database_conn, mask, callback, UserData) == SQLITE_OK);
+	if (sqlite3_trace_v2(m_database_conn, mask, callback, UserData) != SQLITE_OK) return false;
+	//there is only one trace handler per connection, the profiler's is gone now
+	m_profiling = false;
+	return true;
 }
 
 bool nl::database::set_busy_handler(busy_callback callback, void* UserData)
@@ -167,7 +296,49 @@ bool nl::database::set_auth_handler(auth callback, void* UserData)
 
 void nl::database::set_progress_handler(progress_callback callback, void* UserData, int frq)
 {
-	sqlite3_progress_handler(m_database_conn, frq, callback, UserData);
+	m_progress_callback = callback;
+	m_progress_data = UserData;
+	m_progress_frequency = frq;
+	//while a deadline is on, deadline_progress calls the new handler
+	if (!m_deadline_active){
+		sqlite3_progress_handler(m_database_conn, frq, callback, UserData);
+	}
+}
+
+void nl::database::begin_deadline(deadline_t deadline)
+{
+	assert(!m_deadline_active && "Deadlines cannot be nested");
+	m_deadline = deadline;
+	m_deadline_active = true;
+	m_timed_out = false;
+	sqlite3_progress_handler(m_database_conn, m_deadline_steps, &database::deadline_progress, this);
+}
+
+void nl::database::end_deadline()
+{
+	m_deadline_active = false;
+	sqlite3_progress_handler(m_database_conn, m_progress_frequency, m_progress_callback, m_progress_data);
+	if (m_timed_out){
+		m_error_msg = transaction_lost() ? "Query timed out, the open transaction was rolled back" : "Query timed out";
+	}
+}
+
+int nl::database::deadline_progress(void* arg)
+{
+	database* db = static_cast<database*>(arg);
+	if (std::chrono::steady_clock::now() >= db->m_deadline){
+		db->m_timed_out = true;
+		//non zero makes sqlite stop the statement with SQLITE_INTERRUPT
+		return 1;
+	}
+	if (db->m_progress_callback == nullptr) return 0;
+	//the user's handler runs inside sqlite3_step, an exception cannot go back through sqlite so it interrupts the statement
+	try {
+		return db->m_progress_callback(db->m_progress_data);
+	}
+	catch (...) {
+		return 1;
+	}
 }
 
 bool nl::database::register_extension(const sql_extension_func_aggregate& ext)
@@ -176,24 +347,101 @@ bool nl::database::register_extension(const sql_extension_func_aggregate& ext)
 		ext.fUserData, ext.fFunc, ext.fStep, ext.fFinal) == SQLITE_OK);
 }
 
-bool nl::database::connect(const std::string_view& file)
+bool nl::database::connect(const std::string_view& file, const database_options& options)
 {
-	if (file.empty()) {
-		if (sqlite3_open(nullptr, &m_database_conn) == SQLITE_ERROR) {
-			m_error_msg = "FATAL ERROR MESSAGE: COULD NOT OPEN DATABSE IN MEMORY";
+	if (m_database_conn == nullptr)
+	{
+		if (!open_connection(std::string(file), options)) {
 			return false;
 		}
-	}
-	else {
-		if (m_database_conn == nullptr)
-		{
-			return (sqlite3_open(file.data(), &m_database_conn) == SQLITE_ERROR);
-		}
+		prepare_predefined_statements();
+		return true;
 	}
 	m_error_msg = "DATABASE ALREAY OPENED, CLOSE DATABASE BEFORE CONNECTING TO A DIFFERENT ONE";
 	return false;
 }
 
+nl::database_options nl::database_options::performance()
+{
+	database_options options;
+	options.journal_mode = journal::wal;
+	options.synchronous = sync::normal;
+	options.temp = temp_store::memory;
+	options.mmap_size = 256ll * 1024 * 1024;
+	options.cache_size = -64 * 1024;
+	options.busy_timeout = 5000;
+	return options;
+}
+
+bool nl::database::open_connection(const std::string& file, const database_options& options)
+{
+	int flags = (options.read_only ? SQLITE_OPEN_READONLY : (SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE));
+	switch (options.thread_mode)
+	{
+	case database_options::threading::no_mutex:
+		flags |= SQLITE_OPEN_NOMUTEX;
+		break;
+	case database_options::threading::full_mutex:
+		flags |= SQLITE_OPEN_FULLMUTEX;
+		break;
+	default:
+		break;
+	}
+	const char* name = file.empty() ? ":memory:" : file.c_str();
+	if (sqlite3_open_v2(name, &m_database_conn, flags, nullptr) != SQLITE_OK){
+		//sqlite hands back a connection even when opening fails, it only holds the error message
+		m_error_msg = (m_database_conn != nullptr) ? std::string(sqlite3_errmsg(m_database_conn)) : "FATAL ERROR MESSAGE: OUT OF MEMORY";
+		sqlite3_close(m_database_conn);
+		m_database_conn = nullptr;
+		return false;
+	}
+	if (!apply_options(options)){
+		sqlite3_close(m_database_conn);
+		m_database_conn = nullptr;
+		return false;
+	}
+	return true;
+}
+
+bool nl::database::apply_options(const database_options& options)
+{
+	//page_size has to come before journal_mode, a database in WAL mode can no longer change its page size
+	if (options.page_size > 0 && !exec_once(nl::query(fmt::format("PRAGMA page_size={:d};", options.page_size)))){
+		return false;
+	}
+	if (options.busy_timeout > 0 && sqlite3_busy_timeout(m_database_conn, options.busy_timeout) != SQLITE_OK){
+		m_error_msg = std::string(sqlite3_errmsg(m_database_conn));
+		return false;
+	}
+	constexpr std::array<const char*, 7> journal_modes{ "", "WAL", "DELETE", "TRUNCATE", "PERSIST", "MEMORY", "OFF" };
+	//a read only connection cannot switch the file into WAL, it picks the mode up from the file instead
+	if (options.journal_mode != database_options::journal::keep && !options.read_only){
+		const std::string pragma = fmt::format("PRAGMA journal_mode={};", journal_modes[static_cast<size_t>(options.journal_mode)]);
+		if (!exec_once(nl::query(pragma))) return false;
+	}
+	constexpr std::array<const char*, 5> sync_levels{ "", "OFF", "NORMAL", "FULL", "EXTRA" };
+	if (options.synchronous != database_options::sync::keep){
+		const std::string pragma = fmt::format("PRAGMA synchronous={};", sync_levels[static_cast<size_t>(options.synchronous)]);
+		if (!exec_once(nl::query(pragma))) return false;
+	}
+	constexpr std::array<const char*, 3> temp_stores{ "", "FILE", "MEMORY" };
+	if (options.temp != database_options::temp_store::keep){
+		const std::string pragma = fmt::format("PRAGMA temp_store={};", temp_stores[static_cast<size_t>(options.temp)]);
+		if (!exec_once(nl::query(pragma))) return false;
+	}
+	if (options.mmap_size >= 0 && !exec_once(nl::query(fmt::format("PRAGMA mmap_size={:d};", options.mmap_size)))){
+		return false;
+	}
+	if (options.cache_size != 0 && !exec_once(nl::query(fmt::format("PRAGMA cache_size={:d};", options.cache_size)))){
+		return false;
+	}
+	//the read only flag stops writes to the file, query_only also stops them to temp tables and attached databases
+	if (options.read_only && !exec_once(nl::query("PRAGMA query_only=ON;"))){
+		return false;
+	}
+	return true;
+}
+
 void nl::database::cancel()
 {
 	//cancel an operation
@@ -202,12 +450,11 @@ void nl::database::cancel()
 
 bool nl::database::exec_once(statement_index index)
 {
-	auto iter = m_statements.find(index);
-	if (iter == m_statements.end()) {
-		m_error_msg = "Invalid statement index";
+	statement_entry* entry = find_statement(index);
+	if (entry == nullptr){
 		return false;
 	}
-	auto [index_, statement] = *iter;
+	statement_type statement = entry->statement;
 	if (statement)
 	{
 		if (sqlite3_step(statement) == SQLITE_DONE){
@@ -215,6 +462,7 @@ bool nl::database::exec_once(statement_index index)
 				m_error_msg = std::string(sqlite3_errmsg(m_database_conn));
 				return false;
 			}
+			publish_changes();
 			return true;
 		}
 		m_error_msg = std::string(sqlite3_errmsg(m_database_conn));
@@ -223,3 +471,523 @@ bool nl::database::exec_once(statement_index index)
 	return false;
 }
 
+size_t nl::database::batch_row_count(size_t column_count) const
+{
+	assert(column_count > 0 && "Cannot batch a relation with no columns");
+	const int variable_limit = sqlite3_limit(m_database_conn, SQLITE_LIMIT_VARIABLE_NUMBER, -1);
+	const size_t rows = static_cast<size_t>(variable_limit) / column_count;
+	return (rows == 0) ? 1 : rows;
+}
+
+nl::database::statement_type nl::database::prepare_batched_insert(const std::string_view& table, size_t column_count, size_t row_count)
+{
+	std::string row(column_count * 2 + 1, '?');
+	row[0] = '(';
+	for (size_t i = 2; i < row.size(); i += 2){
+		row[i] = ',';
+	}
+	row.back() = ')';
+
+	std::string query = fmt::format("INSERT INTO {} VALUES ", table);
+	query.reserve(query.size() + row_count * (row.size() + 1) + 1);
+	for (size_t i = 0; i < row_count; i++){
+		if (i != 0) query += ',';
+		query += row;
+	}
+	query += ';';
+
+	statement_type statement = nullptr;
+	if (sqlite3_prepare_v2(m_database_conn, query.data(), query.size(), &statement, nullptr) != SQLITE_OK){
+		m_error_msg = std::string(sqlite3_errmsg(m_database_conn));
+		sqlite3_finalize(statement);
+		return nullptr;
+	}
+	return statement;
+}
+
+bool nl::database::begin_operation(stmt begin_stmt)
+{
+	if (m_transaction_depth > 0) return true;
+	statement_type statement = m_statements[begin_stmt].statement;
+	const bool started = (sqlite3_step(statement) == SQLITE_DONE);
+	sqlite3_reset(statement);
+	return started;
+}
+
+bool nl::database::end_operation()
+{
+	if (m_transaction_depth > 0) return true;
+	statement_type statement = m_statements[roll_back ? stmt::rollback : stmt::end].statement;
+	const bool ended = (sqlite3_step(statement) == SQLITE_DONE);
+	sqlite3_reset(statement);
+	if (ended) publish_changes();
+	return ended;
+}
+
+void nl::database::abort_operation()
+{
+	if (m_transaction_depth > 0) return;
+	statement_type statement = m_statements[stmt::rollback].statement;
+	sqlite3_step(statement);
+	sqlite3_reset(statement);
+}
+
+bool nl::database::set_profiling(bool enable)
+{
+	const int ret = enable ? sqlite3_trace_v2(m_database_conn, SQLITE_TRACE_PROFILE, &database::profile_callback, this)
+		: sqlite3_trace_v2(m_database_conn, 0, nullptr, nullptr);
+	if (ret != SQLITE_OK){
+		m_error_msg = std::string(sqlite3_errmsg(m_database_conn));
+		return false;
+	}
+	m_profiling = enable;
+	return true;
+}
+
+int nl::database::profile_callback(unsigned type, void* user_data, void* statement, void* elapsed)
+{
+	if (type != SQLITE_TRACE_PROFILE) return 0;
+	database* db = static_cast<database*>(user_data);
+	auto slot = db->m_statement_slots.find(static_cast<statement_type>(statement));
+	//one off statements from exec_once are not registered
+	if (slot == db->m_statement_slots.end()) return 0;
+	statement_entry& entry = db->m_statements[slot->second];
+	const std::uint64_t nanoseconds = static_cast<std::uint64_t>(*static_cast<sqlite3_int64*>(elapsed));
+	if (entry.latencies.size() < profile_samples){
+		entry.latencies.push_back(nanoseconds);
+	}
+	else{
+		entry.latencies[entry.next_latency] = nanoseconds;
+	}
+	entry.next_latency = (entry.next_latency + 1) % profile_samples;
+	return 0;
+}
+
+std::vector<nl::database::statement_stats> nl::database::stats()
+{
+	std::vector<statement_stats> all;
+	all.reserve(m_statements.size() - m_free_slots.size());
+	std::vector<std::uint64_t> sorted;
+	for (size_t slot = 0; slot < m_statements.size(); slot++){
+		statement_entry& entry = m_statements[slot];
+		if (entry.statement == nullptr) continue;
+
+		statement_stats st;
+		st.index = make_index(static_cast<std::uint32_t>(slot), entry.generation);
+		st.sql = sqlite3_sql(entry.statement);
+		st.calls = sqlite3_stmt_status(entry.statement, SQLITE_STMTSTATUS_RUN, 0);
+		st.full_scan_steps = sqlite3_stmt_status(entry.statement, SQLITE_STMTSTATUS_FULLSCAN_STEP, 0);
+		st.sorts = sqlite3_stmt_status(entry.statement, SQLITE_STMTSTATUS_SORT, 0);
+		st.auto_indexes = sqlite3_stmt_status(entry.statement, SQLITE_STMTSTATUS_AUTOINDEX, 0);
+		st.vm_steps = sqlite3_stmt_status(entry.statement, SQLITE_STMTSTATUS_VM_STEP, 0);
+
+		if (!entry.latencies.empty()){
+			sorted.assign(entry.latencies.begin(), entry.latencies.end());
+			std::sort(sorted.begin(), sorted.end());
+			auto percentile = [&sorted](size_t p) { return std::chrono::nanoseconds(sorted[(sorted.size() - 1) * p / 100]); };
+			st.samples = sorted.size();
+			st.p50 = percentile(50);
+			st.p90 = percentile(90);
+			st.p99 = percentile(99);
+			st.max = std::chrono::nanoseconds(sorted.back());
+		}
+
+		//the plan does not change unless the schema does, so it is only worked out once per statement
+		//even when it comes out empty, statements like BEGIN have no plan
+		if (!entry.query_plan_ready){
+			entry.query_plan_ready = true;
+			const std::string explain = fmt::format("EXPLAIN QUERY PLAN {}", st.sql);
+			statement_type plan = nullptr;
+			if (sqlite3_prepare_v2(m_database_conn, explain.data(), explain.size(), &plan, nullptr) == SQLITE_OK && plan != nullptr){
+				while (sqlite3_step(plan) == SQLITE_ROW){
+					//columns are id, parent, notused and detail
+					const char* detail = (const char*)sqlite3_column_text(plan, 3);
+					if (detail == nullptr) continue;
+					if (!entry.query_plan.empty()) entry.query_plan += '\n';
+					entry.query_plan += detail;
+				}
+			}
+			sqlite3_finalize(plan);
+		}
+		st.query_plan = entry.query_plan;
+		all.push_back(std::move(st));
+	}
+	return all;
+}
+
+bool nl::database::copy_database(sqlite3* source, sqlite3* destination, int pages_per_step, const backup_progress& progress)
+{
+	sqlite3_backup* backup = sqlite3_backup_init(destination, "main", source, "main");
+	if (backup == nullptr){
+		m_error_msg = std::string(sqlite3_errmsg(destination));
+		return false;
+	}
+	int ret = SQLITE_OK;
+	bool cancelled = false;
+	int retries = 0;
+	do {
+		ret = sqlite3_backup_step(backup, pages_per_step);
+		if (ret == SQLITE_OK || ret == SQLITE_BUSY || ret == SQLITE_LOCKED){
+			if (progress && !progress(sqlite3_backup_remaining(backup), sqlite3_backup_pagecount(backup))){
+				cancelled = true;
+				break;
+			}
+			if (ret == SQLITE_OK){
+				retries = 0;
+				continue;
+			}
+			//the source connection is in the middle of its own transaction, waiting would never end
+			if (sqlite3_get_autocommit(source) == 0){
+				break;
+			}
+			if (++retries > backup_busy_retries){
+				break;
+			}
+			//another connection holds the lock, give it a moment before trying the step again
+			sqlite3_sleep(5);
+		}
+	} while (ret == SQLITE_OK || ret == SQLITE_BUSY || ret == SQLITE_LOCKED);
+
+	sqlite3_backup_finish(backup);
+	if (cancelled){
+		m_error_msg = "Backup cancelled";
+		return false;
+	}
+	if ((ret == SQLITE_BUSY || ret == SQLITE_LOCKED) && sqlite3_get_autocommit(source) == 0){
+		m_error_msg = "Backup failed, the source database has an open transaction, commit it before copying";
+		return false;
+	}
+	if (ret == SQLITE_BUSY || ret == SQLITE_LOCKED){
+		m_error_msg = fmt::format("Backup failed, the database stayed locked for {:d} retries: {}", backup_busy_retries, sqlite3_errstr(ret));
+		return false;
+	}
+	if (ret != SQLITE_DONE){
+		m_error_msg = std::string(sqlite3_errstr(ret));
+		return false;
+	}
+	return true;
+}
+
+bool nl::database::backup_to(const std::filesystem::path& file, int pages_per_step, const backup_progress& progress)
+{
+	sqlite3* destination = nullptr;
+	if (sqlite3_open_v2(file.string().c_str(), &destination, SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE, nullptr) != SQLITE_OK){
+		m_error_msg = (destination != nullptr) ? std::string(sqlite3_errmsg(destination)) : "FATAL ERROR MESSAGE: OUT OF MEMORY";
+		sqlite3_close(destination);
+		return false;
+	}
+	const bool copied = copy_database(m_database_conn, destination, pages_per_step, progress);
+	sqlite3_close(destination);
+	return copied;
+}
+
+bool nl::database::backup_to(database& destination, int pages_per_step, const backup_progress& progress)
+{
+	if (&destination == this || !destination.is_open()){
+		m_error_msg = "Invalid backup destination";
+		return false;
+	}
+	return copy_database(m_database_conn, destination.m_database_conn, pages_per_step, progress);
+}
+
+std::unique_ptr<nl::database> nl::database::snapshot_to_memory(int pages_per_step, const backup_progress& progress)
+{
+	auto memory = std::make_unique<database>(std::string_view{});
+	if (!copy_database(m_database_conn, memory->m_database_conn, pages_per_step, progress)){
+		return nullptr;
+	}
+	return memory;
+}
+
+bool nl::database::restore_from(const std::filesystem::path& file, int pages_per_step, const backup_progress& progress)
+{
+	sqlite3* source = nullptr;
+	if (sqlite3_open_v2(file.string().c_str(), &source, SQLITE_OPEN_READONLY, nullptr) != SQLITE_OK){
+		m_error_msg = (source != nullptr) ? std::string(sqlite3_errmsg(source)) : "FATAL ERROR MESSAGE: OUT OF MEMORY";
+		sqlite3_close(source);
+		return false;
+	}
+	//statements prepared on this connection are prepared again by sqlite when the schema they were built on changes
+	const bool copied = copy_database(source, m_database_conn, pages_per_step, progress);
+	sqlite3_close(source);
+	return copied;
+}
+
+nl::database::blob_stream nl::database::open_blob(const std::string& table, const std::string& column, sqlite3_int64 rowid, bool writable)
+{
+	sqlite3_blob* blob = nullptr;
+	if (sqlite3_blob_open(m_database_conn, "main", table.c_str(), column.c_str(), rowid, writable ? 1 : 0, &blob) != SQLITE_OK){
+		m_error_msg = std::string(sqlite3_errmsg(m_database_conn));
+		//sqlite sets blob to nullptr on failure
+		return blob_stream(this, nullptr);
+	}
+	return blob_stream(this, blob);
+}
+
+bool nl::database::write_blob(const std::string& table, const std::string& column, sqlite3_int64 rowid, std::istream& in, size_t buffer_size)
+{
+	blob_stream stream = open_blob(table, column, rowid, true);
+	if (!stream.is_open()) return false;
+	blob_t buffer(std::max<size_t>(buffer_size, 1));
+	while (in){
+		in.read(reinterpret_cast<char*>(buffer.data()), buffer.size());
+		const size_t count = static_cast<size_t>(in.gcount());
+		if (count == 0) break;
+		if (!stream.write(buffer.data(), count)) return false;
+	}
+	return true;
+}
+
+bool nl::database::read_blob(const std::string& table, const std::string& column, sqlite3_int64 rowid, std::ostream& out, size_t buffer_size)
+{
+	blob_stream stream = open_blob(table, column, rowid, false);
+	if (!stream.is_open()) return false;
+	blob_t buffer(std::max<size_t>(buffer_size, 1));
+	while (stream.tell() < stream.size()){
+		const size_t count = stream.read(buffer.data(), buffer.size());
+		if (count == 0) return false;
+		if (!out.write(reinterpret_cast<const char*>(buffer.data()), count)){
+			m_error_msg = "Could not write blob to the output stream";
+			return false;
+		}
+	}
+	return true;
+}
+
+nl::database::blob_stream::blob_stream(database* db, sqlite3_blob* blob)
+: m_database(db), m_blob(blob), m_size(blob != nullptr ? static_cast<size_t>(sqlite3_blob_bytes(blob)) : 0){
+}
+
+nl::database::blob_stream::blob_stream(blob_stream&& rhs) noexcept
+: m_database(rhs.m_database), m_blob(rhs.m_blob), m_size(rhs.m_size), m_position(rhs.m_position){
+	rhs.m_blob = nullptr;
+}
+
+nl::database::blob_stream& nl::database::blob_stream::operator=(blob_stream&& rhs) noexcept
+{
+	if (this != &rhs){
+		if (m_blob) sqlite3_blob_close(m_blob);
+		m_database = rhs.m_database;
+		m_blob = rhs.m_blob;
+		m_size = rhs.m_size;
+		m_position = rhs.m_position;
+		rhs.m_blob = nullptr;
+	}
+	return (*this);
+}
+
+nl::database::blob_stream::~blob_stream()
+{
+	if (m_blob) sqlite3_blob_close(m_blob);
+}
+
+size_t nl::database::blob_stream::read(std::uint8_t* buffer, size_t count)
+{
+	if (m_blob == nullptr) return 0;
+	count = std::min(count, m_size - m_position);
+	if (count == 0) return 0;
+	if (sqlite3_blob_read(m_blob, buffer, static_cast<int>(count), static_cast<int>(m_position)) != SQLITE_OK){
+		m_database->m_error_msg = std::string(sqlite3_errmsg(m_database->m_database_conn));
+		return 0;
+	}
+	m_position += count;
+	return count;
+}
+
+bool nl::database::blob_stream::write(const std::uint8_t* data, size_t count)
+{
+	if (m_blob == nullptr) return false;
+	if (count > m_size - m_position){
+		m_database->m_error_msg = "Write goes past the end of the blob, reserve a bigger zeroblob";
+		return false;
+	}
+	if (sqlite3_blob_write(m_blob, data, static_cast<int>(count), static_cast<int>(m_position)) != SQLITE_OK){
+		m_database->m_error_msg = std::string(sqlite3_errmsg(m_database->m_database_conn));
+		return false;
+	}
+	m_position += count;
+	return true;
+}
+
+bool nl::database::blob_stream::reopen(sqlite3_int64 rowid)
+{
+	if (m_blob == nullptr) return false;
+	if (sqlite3_blob_reopen(m_blob, rowid) != SQLITE_OK){
+		//a failed reopen leaves the handle in an aborted state, it can only be closed
+		m_database->m_error_msg = std::string(sqlite3_errmsg(m_database->m_database_conn));
+		sqlite3_blob_close(m_blob);
+		m_blob = nullptr;
+		m_size = 0;
+		m_position = 0;
+		return false;
+	}
+	m_size = static_cast<size_t>(sqlite3_blob_bytes(m_blob));
+	m_position = 0;
+	return true;
+}
+
+bool nl::database::exec_once(const nl::query& query)
+{
+	char* error = nullptr;
+	if (sqlite3_exec(m_database_conn, query.get_query().c_str(), nullptr, nullptr, &error) != SQLITE_OK){
+		m_error_msg = (error != nullptr) ? std::string(error) : std::string(sqlite3_errmsg(m_database_conn));
+		sqlite3_free(error);
+		return false;
+	}
+	publish_changes();
+	return true;
+}
+
+nl::database::transaction::transaction(database& db, mode m)
+: m_database(db), m_depth(db.m_transaction_depth), m_feed_mark(db.m_change_feed ? db.m_change_feed->pending() : 0){
+	query q;
+	if (m_depth == 0){
+		switch (m)
+		{
+		case immediate:
+			q.begin_immediate();
+			break;
+		case exclusive:
+			q.begin_exclusive();
+			break;
+		default:
+			q.begin();
+			break;
+		}
+	}
+	else{
+		q.savepoint(fmt::format("nl_savepoint_{:d}", m_depth));
+	}
+	if (m_database.exec_once(q)){
+		m_open = true;
+		m_database.m_transaction_depth++;
+	}
+}
+
+nl::database::transaction::~transaction()
+{
+	if (m_open){
+		rollback();
+	}
+}
+
+bool nl::database::transaction::commit()
+{
+	if (!m_open) return false;
+	assert(m_depth + 1 == m_database.m_transaction_depth && "Transactions must be closed in the reverse order they were opened");
+	if (m_database.transaction_lost()){
+		m_database.m_error_msg = "The transaction was rolled back by sqlite, nothing was committed";
+		m_open = false;
+		m_database.m_transaction_depth--;
+		return false;
+	}
+	query q;
+	if (m_depth == 0){
+		q.end();
+	}
+	else{
+		q.release(fmt::format("nl_savepoint_{:d}", m_depth));
+	}
+	//a failed COMMIT (SQLITE_BUSY) leaves the transaction open, it can be retried or rolled back
+	if (!m_database.exec_once(q)) return false;
+	m_open = false;
+	m_database.m_transaction_depth--;
+	return true;
+}
+
+bool nl::database::transaction::rollback()
+{
+	if (!m_open) return false;
+	assert(m_depth + 1 == m_database.m_transaction_depth && "Transactions must be closed in the reverse order they were opened");
+	bool rolled_back = false;
+	if (m_database.transaction_lost()){
+		//already undone, a ROLLBACK now would only fail with no transaction active
+		rolled_back = true;
+	}
+	else if (m_depth == 0){
+		rolled_back = m_database.exec_once(query().roll_back());
+	}
+	else{
+		//ROLLBACK TO undoes the savepoint's changes but keeps it on the stack, RELEASE removes it
+		const std::string name = fmt::format("nl_savepoint_{:d}", m_depth);
+		rolled_back = m_database.exec_once(query().roll_back_to(name));
+		rolled_back = m_database.exec_once(query().release(name)) && rolled_back;
+		//sqlite has no hook for ROLLBACK TO, the changes made since the savepoint are dropped here
+		if (m_database.m_change_feed) m_database.m_change_feed->discard_after(m_feed_mark);
+	}
+	m_open = false;
+	m_database.m_transaction_depth--;
+	return rolled_back;
+}
+
+nl::database::change_feed::change_feed(database& db)
+: m_database(&db){
+	assert(m_database->m_change_feed == nullptr && "Only one change_feed can be attached to a database");
+	m_database->m_change_feed = this;
+	sqlite3_update_hook(m_database->m_database_conn, &change_feed::on_update, this);
+	sqlite3_commit_hook(m_database->m_database_conn, &change_feed::on_commit, this);
+	sqlite3_rollback_hook(m_database->m_database_conn, &change_feed::on_rollback, this);
+}
+
+nl::database::change_feed::~change_feed()
+{
+	sqlite3_update_hook(m_database->m_database_conn, nullptr, nullptr);
+	sqlite3_commit_hook(m_database->m_database_conn, nullptr, nullptr);
+	sqlite3_rollback_hook(m_database->m_database_conn, nullptr, nullptr);
+	m_database->m_change_feed = nullptr;
+}
+
+void nl::database::change_feed::watch(const std::string& table)
+{
+	if (std::find(m_tables.begin(), m_tables.end(), table) == m_tables.end()){
+		m_tables.push_back(table);
+	}
+}
+
+void nl::database::change_feed::on_update(void* arg, int evt, char const*, char const* table_name, sqlite_int64 rowid)
+{
+	change_feed* feed = static_cast<change_feed*>(arg);
+	if (!feed->m_tables.empty() && std::find(feed->m_tables.begin(), feed->m_tables.end(), table_name) == feed->m_tables.end()){
+		return;
+	}
+	feed->m_pending.push_back(change_event{ static_cast<database_evt>(evt), std::string(table_name), rowid });
+}
+
+int nl::database::change_feed::on_commit(void* arg)
+{
+	//the commit is not done yet and the connection must not be used from here, so the batch waits for publish
+	change_feed* feed = static_cast<change_feed*>(arg);
+	if (feed->m_committed.empty()){
+		feed->m_committed = std::move(feed->m_pending);
+	}
+	else{
+		feed->m_committed.insert(feed->m_committed.end(), std::make_move_iterator(feed->m_pending.begin()), std::make_move_iterator(feed->m_pending.end()));
+	}
+	feed->m_pending.clear();
+	//0 lets the commit go ahead
+	return 0;
+}
+
+void nl::database::change_feed::on_rollback(void* arg)
+{
+	//also called when a commit fails after on_commit, the changes it moved along never made it to the database
+	change_feed* feed = static_cast<change_feed*>(arg);
+	feed->m_pending.clear();
+	feed->m_committed.clear();
+}
+
+void nl::database::change_feed::publish()
+{
+	if (m_committed.empty()) return;
+	//listeners may write through the connection and commit again, their changes go into the next batch
+	batch_t batch = std::move(m_committed);
+	m_committed.clear();
+	m_listeners.notify(batch);
+}
+
+void nl::database::change_feed::discard_after(size_t mark)
+{
+	if (mark < m_pending.size()){
+		m_pending.erase(m_pending.begin() + mark, m_pending.end());
+	}
+}
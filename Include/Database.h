@@ -5,11 +5,19 @@
 #include <cassert>
 #include <SQLite/sqlite3.h>
 #include <unordered_map>
+#include <list>
+#include <memory>
+#include <functional>
+#include <iosfwd>
+#include <chrono>
 #include <filesystem>
 
 
 #include "relation.h"
+#include "column_relation.h"
 #include "query.h"
+#include "relation_vtab.h"
+#include "table_listener.h"
 /*
 	NitroLite uses sqlite for database connectivity
 	this class represents a single connection to a database
@@ -81,13 +89,89 @@ namespace nl
 		sql_extension_func_aggregate() = default;
 	};
 
+	//how a connection is opened and the pragmas applied to it right after
+	//the defaults leave every setting as sqlite has it, so a default constructed options opens the connection like sqlite3_open
+	struct database_options
+	{
+		enum class journal : std::uint8_t { keep, wal, rollback_delete, truncate, persist, memory, off };
+		enum class sync : std::uint8_t { keep, off, normal, full, extra };
+		enum class temp_store : std::uint8_t { keep, file, memory };
+		enum class threading : std::uint8_t { keep, no_mutex, full_mutex };
+
+		journal journal_mode{ journal::keep };
+		sync synchronous{ sync::keep };
+		temp_store temp{ temp_store::keep };
+		threading thread_mode{ threading::keep };
+		//bytes of the file mapped into memory, negative keeps the default
+		std::int64_t mmap_size{ -1 };
+		//same meaning as PRAGMA cache_size, positive is pages and negative is KiB, 0 keeps the default
+		std::int32_t cache_size{ 0 };
+		//only takes effect on a new database or after a VACUUM, 0 keeps the default
+		std::int32_t page_size{ 0 };
+		//milliseconds to retry on SQLITE_BUSY before failing, 0 keeps the default of failing at once
+		std::int32_t busy_timeout{ 0 };
+		bool read_only{ false };
+
+		//WAL with synchronous=NORMAL, 256MiB mmap, 64MiB page cache, temp tables in memory and a 5 second busy timeout
+		static database_options performance();
+	};
+
 	class database
 	{
 	//callbacks for sqlite
 	public:
-		typedef std::unordered_map<size_t,sqlite3_stmt*> statements;
-		typedef statements::size_type statement_index;
-		typedef statements::value_type::second_type statement_type;
+		//a prepared statement and the positions of the named parameters last bound to it
+		//the positions are resolved once per parameter name list and reused for every row
+		struct statement_entry
+		{
+			sqlite3_stmt* statement{ nullptr };
+			//the text the statement was prepared from when it is in the query cache, empty otherwise
+			std::string query_text{};
+			std::vector<std::string> parameter_names{};
+			std::vector<int> parameter_positions{};
+			//bumped every time the slot is freed, an index made for an older generation is stale
+			std::uint32_t generation{ 0 };
+			//the most recent run times in nanoseconds while profiling is on, a ring of at most profile_samples
+			std::vector<std::uint64_t> latencies{};
+			size_t next_latency{ 0 };
+			//EXPLAIN QUERY PLAN output, filled the first time stats() sees the statement
+			std::string query_plan{};
+			bool query_plan_ready{ false };
+			//open cursors on the statement, a pinned statement is never evicted from the query cache
+			size_t pins{ 0 };
+		};
+		//statements live in slots of a vector, a free slot has a null statement and is reused by the next prepare
+		typedef std::vector<statement_entry> statements;
+		//the slot in the low 32 bits and the generation of the slot in the high 32 bits
+		typedef std::uint64_t statement_index;
+		typedef sqlite3_stmt* statement_type;
+
+		//what stats() reports for one prepared statement
+		//the counters come from sqlite3_stmt_status and add up over the life of the statement
+		//the latencies are only there while profiling is on and are over the last profile_samples runs
+		struct statement_stats
+		{
+			statement_index index{ 0 };
+			std::string sql{};
+			std::uint64_t calls{ 0 };
+			std::uint64_t full_scan_steps{ 0 };
+			std::uint64_t sorts{ 0 };
+			std::uint64_t auto_indexes{ 0 };
+			std::uint64_t vm_steps{ 0 };
+			size_t samples{ 0 };
+			std::chrono::nanoseconds p50{ 0 };
+			std::chrono::nanoseconds p90{ 0 };
+			std::chrono::nanoseconds p99{ 0 };
+			std::chrono::nanoseconds max{ 0 };
+			std::string query_plan{};
+		};
+
+		struct statement_cache_stats
+		{
+			size_t hits{ 0 };
+			size_t misses{ 0 };
+			size_t evictions{ 0 };
+		};
 		typedef int(*exeu_callback)(void* arg, int col, char** rol_val, char** col_names);
 		typedef int(*commit_callback)(void* arg);
 		typedef void(*rollback_callback)(void* arg);
@@ -95,44 +179,319 @@ namespace nl
 		typedef int(*trace_callback)(std::uint32_t traceType, void* UserData, void* statement, void* traceData);
 		typedef int(*busy_callback)(void* arg, int i);
 		typedef int(*progress_callback)(void* arg);
+		typedef std::chrono::steady_clock::time_point deadline_t;
+		//called after every backup step with the pages still to copy and the page count, return false to stop the backup
+		typedef std::function<bool(int remaining, int page_count)> backup_progress;
 		typedef int(*auth)(void* arg, int eventCode, const char* evt_1, const char* evt_2, const char* database_name, const char* tig_view_name);
 		bool roll_back{false};
 		
-		//pre-defined statement
+		//pre-defined statement, slots 0 to 3 with generation 0 so the enum values are also their indices
 		enum stmt : size_t {
 			begin = 0,
 			begin_immediate,
 			end,
-			rollback
+			rollback,
+			//the first slot a prepared statement can have, the ones below are never removed or reused
+			predefined_count
+		};
+
+
+	public:
+		//a row changed by an insert, update or delete
+		struct change_event
+		{
+			database_evt op{ D_INSERT };
+			std::string table{};
+			sqlite3_int64 rowid{ 0 };
+		};
+
+		//turns the update hook into batches of changes, one batch per committed transaction
+		//changes are buffered as they happen, dropped on rollback (or ROLLBACK TO of a database::transaction savepoint)
+		//and handed to the listeners once the commit has gone through, so listeners can use the connection to re-read the rows
+		//the feed takes over the commit, rollback and update hooks of the connection and clears them when destroyed,
+		//it has to be destroyed before the database, moving the database takes the feed along with the connection
+		//sqlite does not report changes to WITHOUT ROWID tables or rows removed by a DELETE without a WHERE clause
+		class change_feed
+		{
+		public:
+			typedef std::vector<change_event> batch_t;
+			typedef nl::table_listener<void, const batch_t&> listener_t;
+
+			explicit change_feed(database& db);
+			~change_feed();
+
+			//listeners are called with every committed batch, see table_listener for adding them
+			inline listener_t& sink() { return m_listeners; }
+			//only changes to watched tables are recorded, with no watched tables every table is
+			void watch(const std::string& table);
+			inline size_t pending() const { return m_pending.size(); }
+
+		private:
+			friend class database;
+			change_feed(const change_feed&) = delete;
+			change_feed& operator=(const change_feed&) = delete;
+
+			static void on_update(void* arg, int evt, char const*, char const* table_name, sqlite_int64 rowid);
+			static int on_commit(void* arg);
+			static void on_rollback(void* arg);
+			//called by the database after a commit has finished
+			void publish();
+			void discard_after(size_t mark);
+
+			//a pointer so that a moved database can take the feed with it
+			database* m_database;
+			batch_t m_pending{};
+			batch_t m_committed{};
+			std::vector<std::string> m_tables{};
+			listener_t m_listeners{};
+		};
+
+		//reads and writes one blob cell in chunks with sqlite3_blob_read/sqlite3_blob_write, the whole blob is never in memory
+		//the size of the blob is fixed, reserve it with a nl::zeroblob column on insert and fill it through a write stream
+		//the stream is invalidated if the row is changed or deleted by anything else, reads and writes then fail with SQLITE_ABORT
+		class blob_stream
+		{
+		public:
+			blob_stream(blob_stream&& rhs) noexcept;
+			blob_stream& operator=(blob_stream&& rhs) noexcept;
+			~blob_stream();
+
+			inline bool is_open() const { return (m_blob != nullptr); }
+			inline size_t size() const { return m_size; }
+			inline size_t tell() const { return m_position; }
+			inline void seek(size_t position) { m_position = std::min(position, m_size); }
+
+			//reads up to count bytes from the current position, returns the bytes read, 0 at the end or on error
+			size_t read(std::uint8_t* buffer, size_t count);
+			//writes count bytes at the current position, fails if they do not fit in the blob
+			bool write(const std::uint8_t* data, size_t count);
+			//moves the stream to the same column of another row, cheaper than opening a new stream
+			bool reopen(sqlite3_int64 rowid);
+
+		private:
+			friend class database;
+			blob_stream(database* db, sqlite3_blob* blob);
+			blob_stream(const blob_stream&) = delete;
+			blob_stream& operator=(const blob_stream&) = delete;
+
+			database* m_database{ nullptr };
+			sqlite3_blob* m_blob{ nullptr };
+			size_t m_size{ 0 };
+			size_t m_position{ 0 };
+		};
+
+		//streams the rows of a prepared statement instead of copying them all into a relation
+		//rows are decoded one at a time as the cursor moves, only the current row is held in memory
+		//the row can have string_view and blob_view columns, they are not copied and are only valid until the cursor moves
+		//the statement stays open until the cursor is done or destroyed, so the cursor must not outlive the database,
+		//an open cursor pins its statement so the query cache does not evict it, it must still not be removed by hand
+		//and only one cursor should be open on a statement at a time
+		template<typename tuple_t>
+		class cursor
+		{
+		public:
+			constexpr static size_t size = std::tuple_size_v<tuple_t> - 1;
+
+			class iterator
+			{
+			public:
+				using iterator_category = std::input_iterator_tag;
+				using value_type = tuple_t;
+				using difference_type = std::ptrdiff_t;
+				using pointer = const tuple_t*;
+				using reference = const tuple_t&;
+
+				iterator() = default;
+				explicit iterator(cursor* owner) : m_cursor(owner) { ++(*this); }
+
+				reference operator*() const { return m_cursor->m_row; }
+				pointer operator->() const { return &m_cursor->m_row; }
+				iterator& operator++()
+				{
+					if (!m_cursor->next(m_cursor->m_row)) m_cursor = nullptr;
+					return (*this);
+				}
+				void operator++(int) { ++(*this); }
+				bool operator==(const iterator& rhs) const { return m_cursor == rhs.m_cursor; }
+				bool operator!=(const iterator& rhs) const { return m_cursor != rhs.m_cursor; }
+			private:
+				cursor* m_cursor{ nullptr };
+			};
+
+			cursor(cursor&& rhs) noexcept 
+				: m_database(rhs.m_database), m_statement(rhs.m_statement), m_row(std::move(rhs.m_row)), m_done(rhs.m_done), m_failed(rhs.m_failed)
+			{
+				rhs.m_statement = nullptr;
+			}
+			~cursor()
+			{
+				if (m_statement){
+					sqlite3_reset(m_statement);
+					m_database->pin_statement(m_statement, false);
+				}
+			}
+
+			//steps the statement once and decodes the row into row, false when there are no more rows or on error
+			bool next(tuple_t& row)
+			{
+				if (m_statement == nullptr || m_done) return false;
+				const int ret = sqlite3_step(m_statement);
+				if (ret == SQLITE_ROW){
+					row = nl::detail::loop<size>::template do_retrive<tuple_t>(m_statement);
+					return true;
+				}
+				m_done = true;
+				if (ret != SQLITE_DONE){
+					m_failed = true;
+					m_database->m_error_msg = std::string(sqlite3_errmsg(m_database->m_database_conn));
+				}
+				sqlite3_reset(m_statement);
+				return false;
+			}
+
+			//reads at most count rows into a relation, an empty relation means the cursor is done
+			template<typename relation_t>
+			relation_t next_batch(size_t count)
+			{
+				static_assert(nl::detail::is_relation_v<relation_t>, "relation is not a valid relation type");
+				static_assert(std::is_same_v<typename relation_t::tuple_t, tuple_t>, "relation does not have the cursor's row type");
+				static_assert(!nl::detail::has_view_column_v<tuple_t>, "string_view and blob_view columns dangle once stored, read them one row at a time with next");
+				relation_t rel;
+				tuple_t row;
+				for (size_t i = 0; i < count && next(row); i++){
+					if constexpr (nl::detail::is_map_relation<relation_t>::value){
+						rel.insert(std::move(row));
+					}
+					else if constexpr (nl::detail::is_linear_relation<relation_t>::value){
+						rel.push_back(std::move(row));
+					}
+					else if constexpr (nl::detail::is_columnar_relation<relation_t>::value){
+						//splits the row over the columns
+						rel.push_back(std::move(row));
+					}
+					else{
+						//a row stepped here would be lost
+						static_assert(!std::is_same_v<relation_t, relation_t>, "next_batch does not support this kind of relation");
+					}
+				}
+				return rel;
+			}
+
+			inline iterator begin() { return iterator(this); }
+			inline iterator end() { return iterator(); }
+			inline bool done() const { return (m_statement == nullptr || m_done); }
+			inline bool failed() const { return m_failed; }
+
+		private:
+			friend class database;
+			cursor(database* db, statement_type statement) : m_database(db), m_statement(statement), m_failed(statement == nullptr)
+			{
+				if (m_statement) m_database->pin_statement(m_statement, true);
+			}
+			cursor(const cursor&) = delete;
+			cursor& operator=(const cursor&) = delete;
+
+			database* m_database{ nullptr };
+			statement_type m_statement{ nullptr };
+			tuple_t m_row{};
+			bool m_done{ false };
+			bool m_failed{ false };
 		};
 
+		//groups calls on the connection into one transaction, calls made while it is open skip their own BEGIN/END
+		//the outer transaction issues BEGIN and COMMIT, transactions opened inside it are savepoints so library code can compose
+		//transactions must be closed in the reverse order they were opened, an open transaction is rolled back on destruction
+		//a call that fails inside a transaction does not roll it back, the owner of the transaction decides
+		class transaction
+		{
+		public:
+			enum mode
+			{
+				deferred,
+				immediate,
+				exclusive
+			};
+
+			explicit transaction(database& db, mode m = deferred);
+			~transaction();
+
+			bool commit();
+			bool rollback();
+			inline bool is_open() const { return m_open; }
+			inline bool is_savepoint() const { return (m_depth != 0); }
+
+		private:
+			transaction(const transaction&) = delete;
+			transaction& operator=(const transaction&) = delete;
+
+			database& m_database;
+			size_t m_depth{ 0 };
+			//changes the change feed had buffered when the savepoint started
+			size_t m_feed_mark{ 0 };
+			bool m_open{ false };
+		};
 
 	public:
 
-		static size_t index_counter;
-		enum
+		enum : statement_index
 		{
-			BADSTMT = size_t(-1)
+			BADSTMT = statement_index(-1)
 		};
 
 		
 		database();
-		explicit database(const std::string_view& database_file);
-		explicit database(const std::filesystem::path& database_file);
-		database(const database&& connection) noexcept;
-		database& operator=(const database&&) noexcept;
-		void open(const std::filesystem::path& database_file);
+		explicit database(const std::string_view& database_file, const database_options& options = {});
+		explicit database(const std::filesystem::path& database_file, const database_options& options = {});
+		database(database&& connection) noexcept;
+		database& operator=(database&&) noexcept;
+		void open(const std::filesystem::path& database_file, const database_options& options = {});
 		~database();
 
+		//with the query cache off (the default) every call prepares a new statement that belongs to the caller
+		//with it on, the same query text returns the same index, the statement, its bindings, its reset state
+		//and its parameter positions are then shared by everyone that prepared that text, so do not bind it from two places at once
+		//only the capacity most recently used statements are kept, an evicted index becomes invalid and the query has to be prepared again
+		//statements pinned by an open cursor or in the middle of a step are never evicted, the cache can go over capacity until they are done
 		statement_index prepare_query(const std::string& query);
 		statement_index prepare_query(const nl::query& query);
+		//0 turns the query cache off, statements already cached stay prepared but are no longer shared or evicted
+		void set_statement_cache_capacity(size_t capacity);
+		inline size_t get_statement_cache_capacity() const { return m_cache_capacity; }
+		inline const statement_cache_stats& get_statement_cache_stats() const { return m_cache_stats; }
+
+		//run counts, scan/sort/autoindex/vm step counters, latency percentiles and the query plan of every prepared statement
+		std::vector<statement_stats> stats();
+		//times every statement run with SQLITE_TRACE_PROFILE, this takes over the trace handler set with set_trace_handler
+		bool set_profiling(bool enable);
+		inline bool is_profiling() const { return m_profiling; }
+		constexpr static size_t profile_samples = 1024;
 		
 		constexpr inline const statements& get_statements() const { return m_statements; }
 		constexpr inline const std::string& get_error_msg() const { return m_error_msg; }
 		inline const int get_error_code() const { return sqlite3_errcode(m_database_conn); }
 		void remove_statement(nl::database::statement_index index);
 		bool is_open() const { return (m_database_conn != nullptr); }
-		bool connect(const std::string_view& file);
+
+		//a stream over the blob in table.column at rowid, check is_open() on the result
+		blob_stream open_blob(const std::string& table, const std::string& column, sqlite3_int64 rowid, bool writable = false);
+		//copies a whole stream into a reserved blob and a blob out into a stream, through a buffer of buffer_size bytes
+		bool write_blob(const std::string& table, const std::string& column, sqlite3_int64 rowid, std::istream& in, size_t buffer_size = 64 * 1024);
+		bool read_blob(const std::string& table, const std::string& column, sqlite3_int64 rowid, std::ostream& out, size_t buffer_size = 64 * 1024);
+		inline sqlite3_int64 last_insert_rowid() const { return sqlite3_last_insert_rowid(m_database_conn); }
+
+		//online backup with sqlite3_backup_step, pages_per_step pages are copied at a time (-1 copies everything in one step)
+		//the source is only locked during a step, so other connections can write in between,
+		//a write from another connection restarts the copy, writes through this connection are carried over as it goes
+		//a step that finds the source locked is retried every 5ms, up to backup_busy_retries times in a row before the copy fails,
+		//a copy that finds the source locked inside its own open transaction fails at once, the lock it waits on is its own
+		constexpr static int backup_busy_retries = 1000;
+		bool backup_to(const std::filesystem::path& file, int pages_per_step = 256, const backup_progress& progress = {});
+		bool backup_to(database& destination, int pages_per_step = 256, const backup_progress& progress = {});
+		//a consistent copy of this database in a new in memory database, nullptr on failure
+		std::unique_ptr<database> snapshot_to_memory(int pages_per_step = 256, const backup_progress& progress = {});
+		//replaces the contents of this database with the file, for loading a memory database from a snapshot
+		bool restore_from(const std::filesystem::path& file, int pages_per_step = -1, const backup_progress& progress = {});
+		bool connect(const std::string_view& file, const database_options& options = {});
 		void cancel();
 		
 	public:
@@ -143,7 +502,163 @@ namespace nl
 		void set_update_handler(update_callback callback, void* UserData);
 		bool set_auth_handler(auth callback, void* UserData);
 		void set_progress_handler(progress_callback callback, void* UserData, int frq);
+
+		//runs func() and interrupts whatever sqlite is doing for it once deadline passes, timed_out() tells a timeout apart from other errors
+		//the clock is checked from the progress handler every get_deadline_granularity() vm steps,
+		//a handler set with set_progress_handler keeps being called at that granularity while the deadline is on
+		//an interrupt inside a database::transaction can roll the whole transaction back, its commit() then returns false
+		template<typename Func>
+		auto with_deadline(deadline_t deadline, Func&& func) -> decltype(func())
+		{
+			begin_deadline(deadline);
+			//end_deadline has to run even if func throws
+			struct deadline_guard { database* db; ~deadline_guard() { db->end_deadline(); } } guard{ this };
+			return func();
+		}
+
+		template<typename relation>
+		relation retrive(statement_index index, deadline_t deadline)
+		{
+			return with_deadline(deadline, [&]() { return do_query_retrive<relation>(index); });
+		}
+
+		template<typename relation, typename Rep, typename Period>
+		relation retrive(statement_index index, std::chrono::duration<Rep, Period> timeout)
+		{
+			return retrive<relation>(index, std::chrono::steady_clock::now() + timeout);
+		}
+
+		//true when the last call made under a deadline was stopped by it, sqlite reports it as SQLITE_INTERRUPT
+		inline bool timed_out() const { return m_timed_out; }
+		inline void set_deadline_granularity(int vm_steps) { m_deadline_steps = std::max(vm_steps, 1); }
+		inline int get_deadline_granularity() const { return m_deadline_steps; }
 		bool register_extension(const sql_extension_func_aggregate& ext);
+
+		//registers func as a scalar sql function, its argument and return types are mapped like relation columns
+		//func is copied into the connection and destroyed when the function is replaced or the connection closes
+		//an exception thrown by func, of any type, becomes an sql error on the statement that called it
+		//deterministic lets sqlite call func once for constant arguments and use it in indexes and generated columns,
+		//only pass true when func returns the same result for the same arguments (no state, clock or random numbers)
+		template<typename Func>
+		bool register_function(const std::string& name, Func&& func, bool deterministic = false)
+		{
+			using func_t = std::decay_t<Func>;
+			using traits = nl::detail::function_traits<func_t>;
+			using args_t = typename traits::args_t;
+
+			auto call = [](sqlite3_context* context, int, sqlite3_value** argv) {
+				func_t& f = *static_cast<func_t*>(sqlite3_user_data(context));
+				try {
+					auto args = nl::detail::unpack_values<args_t, 0>(argv, std::make_index_sequence<std::tuple_size_v<args_t>>{});
+					if constexpr (std::is_void_v<typename traits::result_t>){
+						std::apply(f, std::move(args));
+						sqlite3_result_null(context);
+					}
+					else {
+						nl::detail::handle_result(context, std::apply(f, std::move(args)));
+					}
+				}
+				catch (const std::exception& e) {
+					sqlite3_result_error(context, e.what(), -1);
+				}
+				catch (...) {
+					//nothing may be thrown back through sqlite's frames
+					sqlite3_result_error(context, "unknown exception", -1);
+				}
+			};
+			auto destroy = [](void* data) { delete static_cast<func_t*>(data); };
+			const int flags = SQLITE_UTF8 | (deterministic ? SQLITE_DETERMINISTIC : 0);
+			//sqlite calls destroy itself when the registration fails
+			if (sqlite3_create_function_v2(m_database_conn, name.c_str(), static_cast<int>(std::tuple_size_v<args_t>), flags,
+				new func_t(std::forward<Func>(func)), call, nullptr, nullptr, destroy) != SQLITE_OK){
+				m_error_msg = std::string(sqlite3_errmsg(m_database_conn));
+				return false;
+			}
+			return true;
+		}
+
+		//makes rel readable from sql as a read only table called table_name, see relation_vtab.h
+		//rel is not copied, it has to outlive the connection (or a later register_relation under the same name) and stay unchanged while it is queried
+		//sorted_column is a column rel is in ascending order on, equality on it is a binary search instead of a scan
+		//set relations are always in order on their first column
+		template<typename relation_t>
+		bool register_relation(const std::string& table_name, const relation_t& rel, size_t sorted_column = relation_vtab<relation_t>::no_sorted_column)
+		{
+			static_assert(nl::detail::is_relation_v<relation_t> || nl::detail::is_map_relation<relation_t>::value, "rel is not a valid relation type");
+			using vtab_t = relation_vtab<relation_t>;
+			if constexpr (nl::detail::is_map_relation<relation_t>::value)
+			{
+				if (sorted_column == vtab_t::no_sorted_column) sorted_column = 0;
+			}
+			assert((sorted_column == vtab_t::no_sorted_column || sorted_column < vtab_t::column_count) && "sorted_column is not a column of the relation");
+			//sqlite calls destroy_registration itself when the registration fails
+			if (sqlite3_create_module_v2(m_database_conn, table_name.c_str(), vtab_t::module(),
+				new typename vtab_t::registration{ &rel, sorted_column }, &vtab_t::destroy_registration) != SQLITE_OK){
+				m_error_msg = std::string(sqlite3_errmsg(m_database_conn));
+				return false;
+			}
+			return true;
+		}
+
+		//registers an sql aggregate, step(State&, args...) runs for every row of a group and finalize(const State&) returns its result
+		//each group starts with a value initialised State, an empty group calls finalize on a fresh State
+		template<typename State, typename Step, typename Final>
+		bool register_aggregate(const std::string& name, Step&& step, Final&& finalize)
+		{
+			struct aggregate
+			{
+				std::decay_t<Step> step_func;
+				std::decay_t<Final> final_func;
+			};
+			using step_args_t = typename nl::detail::function_traits<std::decay_t<Step>>::args_t;
+			static_assert(std::is_same_v<std::tuple_element_t<0, step_args_t>, State>, "the first argument of step must be State&");
+			constexpr int arg_count = static_cast<int>(std::tuple_size_v<step_args_t>) - 1;
+
+			auto call_step = [](sqlite3_context* context, int, sqlite3_value** argv) {
+				aggregate& agg = *static_cast<aggregate*>(sqlite3_user_data(context));
+				//sqlite zeroes the context on the first call of a group, it holds the pointer to the group's State
+				State** state = static_cast<State**>(sqlite3_aggregate_context(context, sizeof(State*)));
+				if (state == nullptr){
+					sqlite3_result_error_nomem(context);
+					return;
+				}
+				try {
+					if (*state == nullptr) *state = new State{};
+					auto args = nl::detail::unpack_values<step_args_t, 1>(argv, std::make_index_sequence<std::tuple_size_v<step_args_t> - 1>{});
+					std::apply([&](auto&&... values) { agg.step_func(**state, std::forward<decltype(values)>(values)...); }, std::move(args));
+				}
+				catch (const std::exception& e) {
+					sqlite3_result_error(context, e.what(), -1);
+				}
+				catch (...) {
+					sqlite3_result_error(context, "unknown exception", -1);
+				}
+			};
+			auto call_final = [](sqlite3_context* context) {
+				aggregate& agg = *static_cast<aggregate*>(sqlite3_user_data(context));
+				//asking for 0 bytes does not allocate, nullptr means step never ran for this group
+				State** state = static_cast<State**>(sqlite3_aggregate_context(context, 0));
+				std::unique_ptr<State> owned((state != nullptr) ? *state : nullptr);
+				try {
+					const State empty{};
+					const State& value = owned ? *owned : empty;
+					nl::detail::handle_result(context, agg.final_func(value));
+				}
+				catch (const std::exception& e) {
+					sqlite3_result_error(context, e.what(), -1);
+				}
+				catch (...) {
+					sqlite3_result_error(context, "unknown exception", -1);
+				}
+			};
+			auto destroy = [](void* data) { delete static_cast<aggregate*>(data); };
+			if (sqlite3_create_function_v2(m_database_conn, name.c_str(), arg_count, SQLITE_UTF8,
+				new aggregate{ std::forward<Step>(step), std::forward<Final>(finalize) }, nullptr, call_step, call_final, destroy) != SQLITE_OK){
+				m_error_msg = std::string(sqlite3_errmsg(m_database_conn));
+				return false;
+			}
+			return true;
+		}
 	
 	//template functions cover
 	public:	
@@ -153,6 +668,43 @@ namespace nl
 			return do_query_retrive<relation>(index);
 		}
 
+		//expected_rows is a hint from the caller, it is reserved up front in vector relations so the result is not reallocated as it grows,
+		//more rows than expected still fit, the relation just grows past the reservation
+		template<typename relation>
+		relation retrive(statement_index index, size_t expected_rows)
+		{
+			return do_query_retrive<relation>(index, expected_rows);
+		}
+
+		template<typename tuple_t>
+		cursor<tuple_t> retrive_cursor(statement_index index)
+		{
+			statement_entry* entry = find_statement(index);
+			if (entry == nullptr){
+				return cursor<tuple_t>(this, nullptr);
+			}
+			return cursor<tuple_t>(this, entry->statement);
+		}
+
+		//calls func(row) for every row without building a relation, func can return false to stop early
+		//with string_view and blob_view columns nothing is allocated per row, the views are only valid during the call
+		template<typename tuple_t, typename Func>
+		bool for_each_row(statement_index index, Func&& func)
+		{
+			cursor<tuple_t> rows = retrive_cursor<tuple_t>(index);
+			tuple_t row{};
+			while (rows.next(row)){
+				if constexpr (std::is_same_v<std::invoke_result_t<Func&, const tuple_t&>, bool>){
+					if (!func(std::as_const(row))) break;
+				}
+				else {
+					func(std::as_const(row));
+				}
+			}
+			return !rows.failed();
+		}
+
+
 		template<typename row_t>
 		row_t retrive_row(statement_index index){
 			return do_query_retrive_row<row_t>(index);
@@ -185,17 +737,29 @@ namespace nl
 			return do_query_insert_para_row(index, row, args...);
 		}
 
+		//inserts the whole relation into table with multi-row "VALUES (?,?),(?,?)..." statements
+		//each statement takes as many rows as sqlite's variable limit allows, the remainder goes through a tail statement
+		//the relation's columns must match the table's columns in order
+		template<typename relation>
+		std::enable_if_t<nl::detail::is_relation_v<relation>, bool>
+			insert_batched(const std::string_view& table, const relation& rel)
+		{
+			return do_query_insert_batched(table, rel);
+		}
+
 		bool exec_once(statement_index index);
+		//runs every statement in the query text without keeping a prepared statement, result rows are ignored
+		//for one off statements like pragmas and transaction control
+		bool exec_once(const nl::query& query);
 		
 		template<typename... Args>
 		bool bind(statement_index index, Args&&... args)
 		{
-			auto iter = m_statements.find(index);
-			if (iter == m_statements.end()) {
-				m_error_msg = "Invalid statement index";
+			statement_entry* entry = find_statement(index);
+			if (entry == nullptr){
 				return false;
 			}
-			auto [idx, statement] = *iter;
+			statement_type statement = entry->statement;
 			constexpr size_t size = sizeof...(args);
 			return nl::detail::loop<size - 1>::do_bind(statement, std::forward_as_tuple<Args...>(args...));
 		}
@@ -210,13 +774,12 @@ namespace nl
 			constexpr const size_t size = sizeof...(Args) - 1;
 
 			const std::array<std::conditional_t<std::is_integral_v<first_t>, first_t, std::string> , sizeof...(Para)> parameters{ paras... };
-			auto iter = m_statements.find(index);
-			if (iter == m_statements.end()) {
-				m_error_msg = "Invalid statement index";
+			statement_entry* entry = find_statement(index);
+			if (entry == nullptr){
 				return false;
 			} 
-			auto [idx, statement] = *iter;
-			return nl::detail::loop<size>::do_bind_para(statement, data, parameters);
+			if (!resolve_parameters(*entry, parameters)) return false;
+			return nl::detail::loop<size>::do_bind_para(entry->statement, data, entry->parameter_positions);
 		}
 
 
@@ -226,101 +789,151 @@ namespace nl
 			return do_update_para(index, row, args...);
 		}
 
+		//applies every row of rel through one prepared statement inside one transaction, instead of one transaction per row
+		//args name (or give the positions of) the statement parameters in tuple order, they are resolved once for the whole relation
+		//a row that fails rolls the whole batch back
+		template<typename relation, typename S, typename...T>
+		std::enable_if_t<nl::detail::is_relation_v<relation>, bool>
+			update_many(statement_index index, const relation& rel, const S& start, const T&... args)
+		{
+			return do_query_insert_para(index, rel, start, args...);
+		}
+
+		//inserts every row of rel into table, a row that conflicts on conflict_columns updates the other columns of the existing row instead
+		//column_names are the table's columns in tuple order, the whole relation goes through one statement in one transaction
+		//the statement is kept in the query cache when it is on, otherwise it is finalized before upsert returns
+		template<typename relation_t>
+		bool upsert(const std::string_view& table, const std::vector<std::string_view>& column_names, const relation_t& rel,
+			const std::vector<std::string_view>& conflict_columns)
+		{
+			static_assert(nl::detail::is_relation_v<relation_t>, "relation is not a valid relation type");
+			constexpr size_t column_count = std::tuple_size_v<typename relation_t::tuple_t>;
+			if (column_names.size() != column_count || conflict_columns.empty()){
+				m_error_msg = "Upsert needs a name for every column and at least one conflict column";
+				return false;
+			}
+			std::vector<std::string_view> update_columns;
+			update_columns.reserve(column_count);
+			std::copy_if(column_names.begin(), column_names.end(), std::back_inserter(update_columns), [&](const std::string_view& name) {
+				return (std::find(conflict_columns.begin(), conflict_columns.end(), name) == conflict_columns.end());
+			});
+
+			nl::query q;
+			q.insert(table).columns(column_names).placeholders(column_count).on_conflict(conflict_columns);
+			if (update_columns.empty()) q.do_nothing();
+			else q.do_update_excluded(update_columns);
+
+			//with the query cache off prepare_query hands back a statement nobody else holds
+			const bool cached = (m_cache_capacity != 0);
+			const statement_index index = prepare_query(q);
+			if (index == BADSTMT) return false;
+			const bool inserted = do_query_insert(index, rel);
+			if (!cached) remove_statement(index);
+			return inserted;
+		}
+
+		//same as above with the table and column names from the relation's BEGIN_COL_NAME block
+		template<typename relation_t>
+		bool upsert(const relation_t& rel, const std::vector<std::string_view>& conflict_columns)
+		{
+			constexpr size_t column_count = std::tuple_size_v<typename relation_t::tuple_t>;
+			const std::vector<std::string_view> column_names(std::begin(relation_t::col_names), std::begin(relation_t::col_names) + column_count);
+			return upsert(relation_t::table_name, column_names, rel, conflict_columns);
+		}
+
 
 
 	//template functions to do the dirty work
 	private:
 		//TODO: retrive_row
 		template<typename relation_t>
-		relation_t do_query_retrive(statement_index index)
+		relation_t do_query_retrive(statement_index index, size_t expected_rows = 0)
 		{
 			static_assert(nl::detail::is_relation_v<relation_t>, "relation is not a valid relation type");
+			static_assert(!nl::detail::has_view_column_v<typename relation_t::tuple_t>, "string_view and blob_view columns dangle once stored, use retrive_cursor or for_each_row");
 
-			auto iter = m_statements.find(index);
-			if (iter == m_statements.end()){
-				m_error_msg = "Invalid statement index";
+			statement_entry* entry = find_statement(index);
+			if (entry == nullptr){
+				return relation_t{};
+			}
+			statement_type statement = entry->statement;
+			if (!begin_operation(stmt::begin)){
+				m_error_msg = sqlite3_errmsg(m_database_conn);
 				return relation_t{};
 			}
-			auto [idx, statement] = *iter;
-			int ret = 0;
-			if ((ret = sqlite3_step(m_statements[stmt::begin])) == SQLITE_DONE)
+			relation_t rel;
+			if constexpr (nl::detail::can_reserve<relation_t>::value)
+			{
+				if (expected_rows != 0) rel.reserve(expected_rows);
+			}
+			constexpr size_t size = std::tuple_size_v<typename relation_t::tuple_t> -1;
+			if constexpr (nl::detail::is_map_relation<relation_t>::value)
 			{
-				
-				relation_t rel;
 				std::insert_iterator<typename relation_t::container_t> insert(rel, rel.begin());
-				constexpr size_t size = std::tuple_size_v<typename relation_t::tuple_t> -1;
 				while ((sqlite3_step(statement) == SQLITE_ROW))
 				{
-					if constexpr (nl::detail::is_map_relation<relation_t>::value)
-					{
-						insert = nl::detail::loop<size>::template do_retrive< typename relation_t::tuple_t>(statement);
-					}
-					else if constexpr (nl::detail::is_linear_relation<relation_t>::value)
-					{
-						std::back_insert_iterator<typename relation_t::container_t> back_insert(rel);
-						back_insert = nl::detail::loop<size>::template do_retrive<typename relation_t::tuple_t>(statement);
-					}
+					insert = nl::detail::loop<size>::template do_retrive< typename relation_t::tuple_t>(statement);
 				}
-				if (sqlite3_errcode(m_database_conn) == SQLITE_DONE)
+			}
+			else if constexpr (nl::detail::is_linear_relation<relation_t>::value || nl::detail::is_columnar_relation<relation_t>::value)
+			{
+				//a column_relation splits the row over its columns in push_back
+				while ((sqlite3_step(statement) == SQLITE_ROW))
 				{
-					if (sqlite3_reset(statement) != SQLITE_OK) {
-						m_error_msg = sqlite3_errmsg(m_database_conn);
-						sqlite3_step(m_statements[stmt::rollback]);
-						sqlite3_reset(m_statements[stmt::rollback]);
-						sqlite3_reset(m_statements[stmt::begin]);
-						return relation_t{};
-					}
-					if (sqlite3_step(m_statements[roll_back ? stmt::rollback : stmt::end]) == SQLITE_DONE)
-					{
-						sqlite3_reset(m_statements[roll_back ? stmt::rollback : stmt::end]);
-						sqlite3_reset(m_statements[begin]);
-						return std::move(rel);
-					}
-				}	
+					rel.push_back(nl::detail::loop<size>::template do_retrive<typename relation_t::tuple_t>(statement));
+				}
 			}
+			if (sqlite3_errcode(m_database_conn) == SQLITE_DONE)
+			{
+				if (sqlite3_reset(statement) != SQLITE_OK) {
+					m_error_msg = sqlite3_errmsg(m_database_conn);
+					abort_operation();
+					return relation_t{};
+				}
+				if (end_operation())
+				{
+					return std::move(rel);
+				}
+			}	
 			m_error_msg = sqlite3_errmsg(m_database_conn);
-			sqlite3_step(m_statements[stmt::rollback]);
-			sqlite3_reset(m_statements[stmt::rollback]);
-			sqlite3_reset(m_statements[stmt::begin]);
+			sqlite3_reset(statement);
+			abort_operation();
 			return relation_t{};
 		}
 
 		template<typename row_t>
 		row_t do_query_retrive_row(statement_index index)
 		{
+			static_assert(!nl::detail::has_view_column_v<row_t>, "string_view and blob_view columns dangle once the statement is reset, use retrive_cursor or for_each_row");
 			constexpr size_t size = std::tuple_size_v<row_t> - 1;
-			auto iter = m_statements.find(index);
-			if (iter == m_statements.end()) {
-				m_error_msg = "Invalid statement index";
+			statement_entry* entry = find_statement(index);
+			if (entry == nullptr){
 				return false;
 			}
 			
-			auto [idx, statement] = *iter;
-			if ((sqlite3_step(m_statements[begin])) == SQLITE_DONE)
-			{
-				auto ret = sqlite3_step(statement);
-				if (ret != SQLITE_ERROR){
-					if (ret == SQLITE_ROW) {
-						m_error_msg = "More than a single row retrived, ignoring others returning only the first";
-					}
-					row_t row = nl::detail::loop<size>::template do_retrive<row_t>(statement);
-					if (sqlite3_reset(statement) != SQLITE_OK) {
-						m_error_msg = sqlite3_errmsg(m_database_conn);
-						sqlite3_step(m_statements[stmt::rollback]);
-						sqlite3_reset(m_statements[stmt::rollback]);
-						sqlite3_reset(m_statements[stmt::begin]);
-						return row_t{};
-					}
-					sqlite3_step(m_statements[ roll_back ? stmt::rollback : stmt::end]);
-					sqlite3_reset(m_statements[roll_back ? stmt::rollback : stmt::end]);
-					sqlite3_reset(m_statements[stmt::begin]);
+			statement_type statement = entry->statement;
+			if (!begin_operation(stmt::begin)){
+				m_error_msg = sqlite3_errmsg(m_database_conn);
+				return row_t{};
+			}
+			auto ret = sqlite3_step(statement);
+			if (ret != SQLITE_ERROR){
+				if (ret == SQLITE_ROW) {
+					m_error_msg = "More than a single row retrived, ignoring others returning only the first";
+				}
+				row_t row = nl::detail::loop<size>::template do_retrive<row_t>(statement);
+				if (sqlite3_reset(statement) != SQLITE_OK) {
+					m_error_msg = sqlite3_errmsg(m_database_conn);
+					abort_operation();
+					return row_t{};
+				}
+				if (end_operation()){
 					return row;
-				} 
+				}
 			}
 			m_error_msg = sqlite3_errmsg(m_database_conn);
-			sqlite3_step(m_statements[stmt::rollback]);
-			sqlite3_reset(m_statements[stmt::rollback]);
-			sqlite3_reset(m_statements[stmt::begin]);
+			sqlite3_reset(statement);
+			abort_operation();
 			return row_t{};
 		}
 
@@ -331,56 +944,47 @@ namespace nl
 		{
 			static_assert(nl::detail::is_relation_v<relation>, "relation is not a valid relation type");
 			constexpr size_t size = std::tuple_size_v<typename relation::tuple_t> - 1;
-			auto  iter = m_statements.find(index);
-			if (iter == m_statements.end()){
-				m_error_msg = "Invalud statement index";
+			statement_entry* entry = find_statement(index);
+			if (entry == nullptr){
 				return false;
 			}
-			auto [idx, statement] = *iter;
+			statement_type statement = entry->statement;
 			//loop::do_insert should actually be called do_bind, it binds values to insert statements 
-			if (sqlite3_step(m_statements[begin_immediate]) == SQLITE_DONE){
-				for (auto& tuple : rel) {
-					if (!nl::detail::loop<size>::do_bind(statement, tuple)) {
-						m_error_msg = std::string(sqlite3_errmsg(m_database_conn));
-						sqlite3_clear_bindings(statement);
-						sqlite3_step(m_statements[stmt::rollback]);
-						sqlite3_reset(statement);
-						sqlite3_reset(m_statements[stmt::rollback]);
-						sqlite3_reset(m_statements[stmt::begin_immediate]);
-						return false;
-					}
-					if (sqlite3_step(statement) == SQLITE_DONE) {
-							if(sqlite3_reset(statement) != SQLITE_OK) {
-								m_error_msg = std::string(sqlite3_errmsg(m_database_conn));
-								sqlite3_clear_bindings(statement);
-								sqlite3_step(m_statements[stmt::rollback]);
-								sqlite3_reset(m_statements[stmt::rollback]);
-								sqlite3_reset(m_statements[stmt::begin_immediate]);
-								return false;
-							}
+			if (!begin_operation(stmt::begin_immediate)){
+				m_error_msg = std::string(sqlite3_errmsg(m_database_conn));
+				return false;
+			}
+			for (const auto& tuple : rel) {
+				if (!nl::detail::loop<size>::template do_bind<nl::detail::bind_mode::reference>(statement, tuple)) {
+					m_error_msg = std::string(sqlite3_errmsg(m_database_conn));
+					sqlite3_clear_bindings(statement);
+					sqlite3_reset(statement);
+					abort_operation();
+					return false;
+				}
+				if (sqlite3_step(statement) == SQLITE_DONE) {
+						if(sqlite3_reset(statement) != SQLITE_OK) {
+							m_error_msg = std::string(sqlite3_errmsg(m_database_conn));
 							sqlite3_clear_bindings(statement);
-					}
-					else{
-						m_error_msg = std::string(sqlite3_errmsg(m_database_conn));
+							abort_operation();
+							return false;
+						}
 						sqlite3_clear_bindings(statement);
-						sqlite3_step(m_statements[stmt::rollback]);
-						sqlite3_reset(statement);
-						sqlite3_reset(m_statements[stmt::rollback]);
-						sqlite3_reset(m_statements[stmt::begin_immediate]);
-						return false;
-					}
 				}
-				if (sqlite3_step(m_statements[roll_back ? stmt::rollback : stmt::end]) == SQLITE_DONE) {
-					sqlite3_reset(m_statements[roll_back ? stmt::rollback : stmt::end]);
-					sqlite3_reset(m_statements[begin_immediate]);
-					return true;
+				else{
+					m_error_msg = std::string(sqlite3_errmsg(m_database_conn));
+					sqlite3_clear_bindings(statement);
+					sqlite3_reset(statement);
+					abort_operation();
+					return false;
 				}
 			}
+			if (end_operation()) {
+				return true;
+			}
 
 			m_error_msg = std::string(sqlite3_errmsg(m_database_conn));
-			sqlite3_step(m_statements[stmt::rollback]);
-			sqlite3_reset(m_statements[stmt::rollback]);
-			sqlite3_reset(m_statements[stmt::begin_immediate]);
+			abort_operation();
 			return false;
 		}
 
@@ -388,54 +992,44 @@ namespace nl
 		bool do_query_insert_row(statement_index index, const row_t & row)
 		{
 			constexpr size_t size = std::tuple_size_v<row_t> -1;
-			auto iter = m_statements.find(index);
-			if (iter == m_statements.end()){
-				m_error_msg = "Invalid statement index";
+			statement_entry* entry = find_statement(index);
+			if (entry == nullptr){
 				return false;
 			}
-			auto [idx, statement] = *iter;
-			if (sqlite3_step(m_statements[begin_immediate]) == SQLITE_DONE)
+			statement_type statement = entry->statement;
+			if (!begin_operation(stmt::begin_immediate)){
+				m_error_msg = std::string(sqlite3_errmsg(m_database_conn));
+				return false;
+			}
+			if (!nl::detail::loop<size>::template do_bind<nl::detail::bind_mode::reference>(statement, row))
 			{
-				if (!nl::detail::loop<size>::do_bind(statement, row))
-				{
-					m_error_msg = std::string(sqlite3_errmsg(m_database_conn));
-					sqlite3_clear_bindings(statement);
-					sqlite3_step(m_statements[stmt::rollback]);
-					sqlite3_reset(statement);
-					sqlite3_reset(m_statements[stmt::rollback]);
-					sqlite3_reset(m_statements[stmt::begin_immediate]);
-					return false;
-				}
-				if (sqlite3_step(statement) == SQLITE_DONE) {
-					if (sqlite3_reset(statement) != SQLITE_OK) {
-						m_error_msg = std::string(sqlite3_errmsg(m_database_conn));
-						sqlite3_clear_bindings(statement);
-						sqlite3_step(m_statements[stmt::rollback]);
-						sqlite3_reset(m_statements[stmt::rollback]);
-						sqlite3_reset(m_statements[stmt::begin_immediate]);
-						return false;
-					}
-					sqlite3_clear_bindings(statement);
-				}
-				else {
+				m_error_msg = std::string(sqlite3_errmsg(m_database_conn));
+				sqlite3_clear_bindings(statement);
+				sqlite3_reset(statement);
+				abort_operation();
+				return false;
+			}
+			if (sqlite3_step(statement) == SQLITE_DONE) {
+				if (sqlite3_reset(statement) != SQLITE_OK) {
 					m_error_msg = std::string(sqlite3_errmsg(m_database_conn));
 					sqlite3_clear_bindings(statement);
-					sqlite3_step(m_statements[stmt::rollback]);
-					sqlite3_reset(statement);
-					sqlite3_reset(m_statements[stmt::rollback]);
-					sqlite3_reset(m_statements[stmt::begin_immediate]);
+					abort_operation();
 					return false;
 				}
-				if (sqlite3_step(m_statements[roll_back ? stmt::rollback : stmt::end]) == SQLITE_DONE) {
-					sqlite3_reset(m_statements[roll_back ? stmt::rollback : stmt::end]);
-					sqlite3_reset(m_statements[begin_immediate]);
-					return true;
-				}
+				sqlite3_clear_bindings(statement);
+			}
+			else {
+				m_error_msg = std::string(sqlite3_errmsg(m_database_conn));
+				sqlite3_clear_bindings(statement);
+				sqlite3_reset(statement);
+				abort_operation();
+				return false;
+			}
+			if (end_operation()) {
+				return true;
 			}
 			m_error_msg = std::string(sqlite3_errmsg(m_database_conn));
-			sqlite3_step(m_statements[stmt::rollback]);
-			sqlite3_reset(m_statements[stmt::rollback]);
-			sqlite3_reset(m_statements[stmt::begin_immediate]);
+			abort_operation();
 			return false;
 		}
 		
@@ -451,56 +1045,48 @@ namespace nl
 			static_assert(nl::detail::is_relation_v<relation>, "relation is not a valid relation type");
 			const std::array<const S, sizeof...(T) + 1> parameters{start, args...};
 			constexpr size_t size = std::tuple_size_v<typename relation::tuple_t> - 1;
-			auto iter = m_statements.find(index);
-			if (iter == m_statements.end()){
-				m_error_msg = "Invalid statement index";
+			statement_entry* entry = find_statement(index);
+			if (entry == nullptr){
 				return false;
 			}
-			auto [idx, statement] = *iter;
-			if (sqlite3_step(m_statements[stmt::begin_immediate]) == SQLITE_DONE)
-			{
-				for (auto& tuple : rel){
-					if (!nl::detail::loop<size>::do_bind_para(statement, tuple, parameters)){
-						m_error_msg = std::string(sqlite3_errmsg(m_database_conn));
-						sqlite3_clear_bindings(statement);
-						sqlite3_step(m_statements[stmt::rollback]);
-						sqlite3_reset(statement);
-						sqlite3_reset(m_statements[stmt::rollback]);
-						sqlite3_reset(m_statements[stmt::begin_immediate]);
-						return false;
-					}
-					//execute the insert statement
-					if (sqlite3_step(statement) == SQLITE_DONE){
-						if (sqlite3_reset(statement) != SQLITE_OK)
-						{
-							m_error_msg = std::string(sqlite3_errmsg(m_database_conn));
-							sqlite3_clear_bindings(statement);
-							sqlite3_step(m_statements[stmt::rollback]);
-							sqlite3_reset(m_statements[stmt::rollback]);
-							sqlite3_reset(m_statements[stmt::begin_immediate]);
-							return false;
-						}
-						sqlite3_clear_bindings(statement);
-					}else{
+			statement_type statement = entry->statement;
+			if (!resolve_parameters(*entry, parameters)) return false;
+			const std::vector<int>& positions = entry->parameter_positions;
+			if (!begin_operation(stmt::begin_immediate)){
+				m_error_msg = std::string(sqlite3_errmsg(m_database_conn));
+				return false;
+			}
+			for (const auto& tuple : rel){
+				if (!nl::detail::loop<size>::template do_bind_para<nl::detail::bind_mode::reference>(statement, tuple, positions)){
+					m_error_msg = std::string(sqlite3_errmsg(m_database_conn));
+					sqlite3_clear_bindings(statement);
+					sqlite3_reset(statement);
+					abort_operation();
+					return false;
+				}
+				//execute the insert statement
+				if (sqlite3_step(statement) == SQLITE_DONE){
+					if (sqlite3_reset(statement) != SQLITE_OK)
+					{
 						m_error_msg = std::string(sqlite3_errmsg(m_database_conn));
 						sqlite3_clear_bindings(statement);
-						sqlite3_step(m_statements[stmt::rollback]);
-						sqlite3_reset(statement);
-						sqlite3_reset(m_statements[stmt::rollback]);
-						sqlite3_reset(m_statements[stmt::begin_immediate]);
+						abort_operation();
 						return false;
 					}
-				}
-				if (sqlite3_step(m_statements[roll_back ? stmt::rollback : stmt::end]) == SQLITE_DONE){
-					sqlite3_reset(m_statements[roll_back ? stmt::rollback : stmt::end]);
-					sqlite3_reset(m_statements[stmt::begin_immediate]);
-					return true;
+					sqlite3_clear_bindings(statement);
+				}else{
+					m_error_msg = std::string(sqlite3_errmsg(m_database_conn));
+					sqlite3_clear_bindings(statement);
+					sqlite3_reset(statement);
+					abort_operation();
+					return false;
 				}
 			}
+			if (end_operation()){
+				return true;
+			}
 			m_error_msg = sqlite3_errmsg(m_database_conn);
-			sqlite3_step(m_statements[stmt::rollback]);
-			sqlite3_reset(m_statements[stmt::rollback]);
-			sqlite3_reset(m_statements[stmt::begin_immediate]);
+			abort_operation();
 			return false;
 		}
 
@@ -509,49 +1095,43 @@ namespace nl
 		{
 			const std::array<const S, sizeof...(T) + 1> parameters{ start, args... };
 			constexpr size_t size = std::tuple_size_v<row_t> -1;
-			auto iter = m_statements.find(index);
-			if (iter == m_statements.end()){
-				m_error_msg = "Invalid statement index";
+			statement_entry* entry = find_statement(index);
+			if (entry == nullptr){
 				return false;
 			}
-			auto [idx, statement] = *iter;
-			if (sqlite3_step(m_statements[stmt::begin_immediate]) == SQLITE_DONE)
-			{
-					if (!nl::detail::loop<size>::do_bind_para(statement, row, parameters)) {
-						m_error_msg = std::string(sqlite3_errmsg(m_database_conn));
-						sqlite3_clear_bindings(statement);
-						sqlite3_step(m_statements[stmt::rollback]);
-						sqlite3_reset(statement);
-						sqlite3_reset(m_statements[stmt::rollback]);
-						sqlite3_reset(m_statements[stmt::begin_immediate]);
-						return false;
-					}
-					//execute the insert statement
-					if (sqlite3_step(statement) == SQLITE_DONE) {
-						if (sqlite3_reset(statement) != SQLITE_OK)
-						{
-							m_error_msg = std::string(sqlite3_errmsg(m_database_conn));
-							sqlite3_clear_bindings(statement);
-							sqlite3_step(m_statements[stmt::rollback]);
-							sqlite3_reset(m_statements[stmt::rollback]);
-							sqlite3_reset(m_statements[stmt::begin_immediate]);
-							return false;
-						}
-						sqlite3_clear_bindings(statement);
-					}
-					else {
-						m_error_msg = std::string(sqlite3_errmsg(m_database_conn));
-						sqlite3_clear_bindings(statement);
-						sqlite3_step(m_statements[stmt::rollback]);
-						sqlite3_reset(statement);
-						sqlite3_reset(m_statements[stmt::rollback]);
-						sqlite3_reset(m_statements[stmt::begin_immediate]);
-						return false;
-					}
+			statement_type statement = entry->statement;
+			if (!resolve_parameters(*entry, parameters)) return false;
+			const std::vector<int>& positions = entry->parameter_positions;
+			if (!begin_operation(stmt::begin_immediate)){
+				m_error_msg = std::string(sqlite3_errmsg(m_database_conn));
+				return false;
+			}
+			if (!nl::detail::loop<size>::template do_bind_para<nl::detail::bind_mode::reference>(statement, row, positions)) {
+				m_error_msg = std::string(sqlite3_errmsg(m_database_conn));
+				sqlite3_clear_bindings(statement);
+				sqlite3_reset(statement);
+				abort_operation();
+				return false;
 			}
-			if (sqlite3_step(m_statements[roll_back ? stmt::rollback : stmt::end]) == SQLITE_DONE) {
-				sqlite3_reset(m_statements[roll_back ? stmt::rollback : stmt::end]);
-				sqlite3_reset(m_statements[stmt::begin_immediate]);
+			//execute the insert statement
+			if (sqlite3_step(statement) == SQLITE_DONE) {
+				if (sqlite3_reset(statement) != SQLITE_OK)
+				{
+					m_error_msg = std::string(sqlite3_errmsg(m_database_conn));
+					sqlite3_clear_bindings(statement);
+					abort_operation();
+					return false;
+				}
+				sqlite3_clear_bindings(statement);
+			}
+			else {
+				m_error_msg = std::string(sqlite3_errmsg(m_database_conn));
+				sqlite3_clear_bindings(statement);
+				sqlite3_reset(statement);
+				abort_operation();
+				return false;
+			}
+			if (end_operation()) {
 				return true;
 			}
 
@@ -559,9 +1139,68 @@ namespace nl
 			//might also get an SQLITE_BUSY if a write lock on the database cant be aquired, need to rollback 
 			//but i hope sqlite would set an error
 			m_error_msg = std::string(sqlite3_errmsg(m_database_conn));
-			sqlite3_step(m_statements[stmt::rollback]);
-			sqlite3_reset(m_statements[stmt::rollback]);
-			sqlite3_reset(m_statements[stmt::begin_immediate]);
+			abort_operation();
+			return false;
+		}
+
+		template<typename relation>
+		bool do_query_insert_batched(const std::string_view& table, const relation& rel)
+		{
+			static_assert(nl::detail::is_relation_v<relation>, "relation is not a valid relation type");
+			constexpr size_t column_count = std::tuple_size_v<typename relation::tuple_t>;
+			constexpr size_t size = column_count - 1;
+			if (rel.empty()) return true;
+
+			const size_t batch_rows = batch_row_count(column_count);
+			const size_t batch_count = rel.size() / batch_rows;
+			const size_t tail_rows = rel.size() % batch_rows;
+			statement_type batch_statement = nullptr;
+			statement_type tail_statement = nullptr;
+			if (batch_count > 0 && (batch_statement = prepare_batched_insert(table, column_count, batch_rows)) == nullptr){
+				return false;
+			}
+			if (tail_rows > 0 && (tail_statement = prepare_batched_insert(table, column_count, tail_rows)) == nullptr){
+				sqlite3_finalize(batch_statement);
+				return false;
+			}
+
+			auto iter = rel.begin();
+			//binds the next rows from iter into statement and steps it once
+			auto bind_step = [&](statement_type statement, size_t rows) -> bool {
+				for (size_t row = 0; row < rows; row++, iter++){
+					if (!nl::detail::loop<size>::template do_bind<nl::detail::bind_mode::reference>(statement, *iter, row * column_count)){
+						return false;
+					}
+				}
+				if (sqlite3_step(statement) != SQLITE_DONE){
+					sqlite3_reset(statement);
+					return false;
+				}
+				return (sqlite3_reset(statement) == SQLITE_OK);
+			};
+
+			if (!begin_operation(stmt::begin_immediate)){
+				m_error_msg = std::string(sqlite3_errmsg(m_database_conn));
+				sqlite3_finalize(batch_statement);
+				sqlite3_finalize(tail_statement);
+				return false;
+			}
+			bool done = true;
+			for (size_t i = 0; i < batch_count && done; i++){
+				done = bind_step(batch_statement, batch_rows);
+			}
+			if (done && tail_rows > 0){
+				done = bind_step(tail_statement, tail_rows);
+			}
+			if (done && end_operation()){
+				sqlite3_finalize(batch_statement);
+				sqlite3_finalize(tail_statement);
+				return true;
+			}
+			m_error_msg = std::string(sqlite3_errmsg(m_database_conn));
+			abort_operation();
+			sqlite3_finalize(batch_statement);
+			sqlite3_finalize(tail_statement);
 			return false;
 		}
 
@@ -571,41 +1210,44 @@ namespace nl
 			const std::array<const S, sizeof...(T) + 1> parameters{ start, args... };
 			constexpr size_t size = std::tuple_size_v<row_t> -1;
 
-			auto iter = m_statements.find(index);
-			if (iter == m_statements.end())
-			{
-				m_error_msg = "Invalid statement index";
+			statement_entry* entry = find_statement(index);
+			if (entry == nullptr){
 				return false;
 			}
-			auto [idx, statement] = *iter;
+			statement_type statement = entry->statement;
+			if (!resolve_parameters(*entry, parameters)) return false;
+			const std::vector<int>& positions = entry->parameter_positions;
 			
-			if (nl::detail::loop<size>::template do_bind_para(statement, row, parameters))
+			if (nl::detail::loop<size>::template do_bind_para<nl::detail::bind_mode::reference>(statement, row, positions))
 			{
-				if (sqlite3_step(m_statements[stmt::begin_immediate]) == SQLITE_DONE)
+				if (!begin_operation(stmt::begin_immediate)){
+					m_error_msg = std::string(sqlite3_errmsg(m_database_conn));
+					sqlite3_clear_bindings(statement);
+					return false;
+				}
+				if (sqlite3_step(statement) == SQLITE_DONE)
 				{
-					if (sqlite3_step(statement) == SQLITE_DONE)
+					if (sqlite3_reset(statement) != SQLITE_OK)
 					{
-						if (sqlite3_reset(statement) != SQLITE_OK)
-						{
-							m_error_msg = std::string(sqlite3_errmsg(m_database_conn));
-							return false;
-						}
-						sqlite3_clear_bindings(statement);
-					}
-					else {
 						m_error_msg = std::string(sqlite3_errmsg(m_database_conn));
+						sqlite3_clear_bindings(statement);
+						abort_operation();
 						return false;
 					}
+					sqlite3_clear_bindings(statement);
+				}
+				else {
+					m_error_msg = std::string(sqlite3_errmsg(m_database_conn));
+					sqlite3_clear_bindings(statement);
+					sqlite3_reset(statement);
+					abort_operation();
+					return false;
 				}
-				if (sqlite3_step(m_statements[roll_back ? stmt::rollback : stmt::end]) == SQLITE_DONE) {
-					sqlite3_reset(m_statements[roll_back ? stmt::rollback : stmt::end]);
-					sqlite3_reset(m_statements[stmt::begin_immediate]);
+				if (end_operation()) {
 					return true;
 				}
 				m_error_msg = std::string(sqlite3_errmsg(m_database_conn));
-				sqlite3_step(m_statements[stmt::rollback]);
-				sqlite3_reset(m_statements[stmt::rollback]);
-				sqlite3_reset(m_statements[stmt::begin_immediate]);
+				abort_operation();
 				return false;
 			}
 			//error that is not caught, hopefully lool i dont know,
@@ -618,6 +1260,90 @@ namespace nl
 		}
 
 	private:
+		constexpr static statement_index make_index(std::uint32_t slot, std::uint32_t generation)
+		{
+			return ((statement_index(generation) << 32) | slot);
+		}
+		constexpr static size_t slot_of(statement_index index) { return size_t(index & 0xFFFFFFFF); }
+
+		//the live entry for index, nullptr when the slot is out of range, free or was reused since the index was made
+		inline statement_entry* find_statement(statement_index index)
+		{
+			const size_t slot = slot_of(index);
+			if (slot >= m_statements.size() || m_statements[slot].statement == nullptr
+				|| m_statements[slot].generation != std::uint32_t(index >> 32)){
+				m_error_msg = "Invalid or stale statement index";
+				return nullptr;
+			}
+			return &m_statements[slot];
+		}
+
+		//maps the parameter names to their positions in the statement, only looked up when the names differ from the last call
+		//integral parameters are already positions and are used as they are
+		template<typename para_array_t>
+		bool resolve_parameters(statement_entry& entry, const para_array_t& parameters)
+		{
+			using para_t = std::decay_t<typename para_array_t::value_type>;
+			if constexpr (std::is_integral_v<para_t>)
+			{
+				entry.parameter_names.clear();
+				entry.parameter_positions.assign(parameters.begin(), parameters.end());
+				return true;
+			}
+			else
+			{
+				if (std::equal(entry.parameter_names.begin(), entry.parameter_names.end(), parameters.begin(), parameters.end())){
+					return true;
+				}
+				entry.parameter_names.clear();
+				entry.parameter_positions.resize(parameters.size());
+				for (size_t i = 0; i < parameters.size(); i++){
+					const std::string p_name = fmt::format(":{}", parameters[i]);
+					const int position = sqlite3_bind_parameter_index(entry.statement, p_name.c_str());
+					if (position == 0){
+						m_error_msg = fmt::format("Invalid parameter name {}", p_name);
+						entry.parameter_positions.clear();
+						return false;
+					}
+					entry.parameter_positions[i] = position;
+				}
+				entry.parameter_names.assign(parameters.begin(), parameters.end());
+				return true;
+			}
+		}
+
+		//opens m_database_conn with sqlite3_open_v2 and applies the pragmas in options, an empty file opens a memory database
+		bool open_connection(const std::string& file, const database_options& options);
+		static int profile_callback(unsigned type, void* user_data, void* statement, void* elapsed);
+		bool copy_database(sqlite3* source, sqlite3* destination, int pages_per_step, const backup_progress& progress);
+		inline void publish_changes() { if (m_change_feed) m_change_feed->publish(); }
+		void begin_deadline(deadline_t deadline);
+		void end_deadline();
+		static int deadline_progress(void* arg);
+		bool apply_options(const database_options& options);
+
+		//prepares and registers a statement without going through the query cache
+		statement_index prepare_statement(const std::string& query);
+		//removes least recently used cached statements until the cache fits its capacity, skipping pinned and busy ones
+		void evict_statements();
+		void pin_statement(statement_type statement, bool pin);
+		//takes over the connection and every piece of state of a database being moved from, leaving it closed
+		void take_connection(database& connection);
+		void prepare_predefined_statements();
+
+		//an interrupt (a deadline running out) can make sqlite roll back the whole transaction on its own,
+		//then database::transactions are still counted as open while the connection is back in autocommit
+		inline bool transaction_lost() const { return (m_transaction_depth > 0 && sqlite3_get_autocommit(m_database_conn) != 0); }
+		//the per call transaction around retrive, insert and update, does nothing while a database::transaction is open
+		bool begin_operation(stmt begin_stmt);
+		bool end_operation();
+		void abort_operation();
+
+		//rows that fit in one multi-row insert statement without going over SQLITE_LIMIT_VARIABLE_NUMBER
+		size_t batch_row_count(size_t column_count) const;
+		//prepares "INSERT INTO table VALUES (?,..),(?,..)" for row_count rows, the statement is not kept in m_statements
+		statement_type prepare_batched_insert(const std::string_view& table, size_t column_count, size_t row_count);
+
 		//cannot copy or assign a database connection, every created on is a new connection, 
 		//a database connection is a resource that is usually only one in a process
 		database(const database&) = delete;
@@ -626,8 +1352,33 @@ namespace nl
 
 
 		sqlite3* m_database_conn{nullptr};
+		struct cache_entry
+		{
+			statement_index index;
+			std::list<statement_index>::iterator lru_position;
+		};
+
 		statements m_statements{};
+		std::vector<std::uint32_t> m_free_slots{};
+		//only used to find the entry of the statement in a profile event
+		std::unordered_map<statement_type, std::uint32_t> m_statement_slots{};
+		bool m_profiling{ false };
+		change_feed* m_change_feed{ nullptr };
+		//the handler from set_progress_handler, put back when a deadline ends
+		progress_callback m_progress_callback{ nullptr };
+		void* m_progress_data{ nullptr };
+		int m_progress_frequency{ 0 };
+		deadline_t m_deadline{};
+		int m_deadline_steps{ 1000 };
+		bool m_deadline_active{ false };
+		bool m_timed_out{ false };
 		std::string m_error_msg{};
+		//query text to statement, m_lru has the cached indices from most to least recently prepared
+		std::unordered_map<std::string, cache_entry> m_query_cache{};
+		std::list<statement_index> m_lru{};
+		size_t m_cache_capacity{ 0 };
+		statement_cache_stats m_cache_stats{};
+		size_t m_transaction_depth{ 0 };
 	};
 
 
@@ -0,0 +1,342 @@
+#include "../pch.h"
+#include "aggregate_kernels.h"
+
+#if defined(_M_X64) || defined(__x86_64__)
+#define NL_KERNEL_X86 1
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+//msvc compiles intrinsics for any target, the cpu check is what keeps them off older cpus
+#define NL_TARGET_AVX2
+#else
+#define NL_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#else
+#define NL_KERNEL_X86 0
+#endif
+
+namespace
+{
+	bool detect_avx2()
+	{
+#if NL_KERNEL_X86
+#if defined(_MSC_VER)
+		int regs[4]{};
+		__cpuid(regs, 0);
+		if (regs[0] < 7) return false;
+		__cpuid(regs, 1);
+		//the os has to save the ymm registers on a context switch, OSXSAVE and XCR0 bits 1 and 2
+		const bool osxsave = (regs[2] & (1 << 27)) != 0;
+		if (!osxsave || (_xgetbv(0) & 0x6) != 0x6) return false;
+		__cpuidex(regs, 7, 0);
+		return (regs[1] & (1 << 5)) != 0;
+#else
+		__builtin_cpu_init();
+		return __builtin_cpu_supports("avx2") != 0;
+#endif
+#else
+		return false;
+#endif
+	}
+
+	//checked once, on first use
+	bool avx2_enabled()
+	{
+		static const bool enabled = detect_avx2();
+		return enabled;
+	}
+
+	template<typename T>
+	double scalar_squared_deviation(const T* data, size_t size, double mean)
+	{
+		//two chains, the compiler is not allowed to reorder the floating point adds itself
+		double s0 = 0.0, s1 = 0.0;
+		size_t i = 0;
+		for (; i + 2 <= size; i += 2){
+			const double d0 = static_cast<double>(data[i]) - mean;
+			const double d1 = static_cast<double>(data[i + 1]) - mean;
+			s0 += d0 * d0;
+			s1 += d1 * d1;
+		}
+		for (; i < size; i++){
+			const double d = static_cast<double>(data[i]) - mean;
+			s0 += d * d;
+		}
+		return s0 + s1;
+	}
+
+#if NL_KERNEL_X86
+	NL_TARGET_AVX2 inline double hsum(__m256d v)
+	{
+		const __m128d lo = _mm256_castpd256_pd128(v);
+		const __m128d hi = _mm256_extractf128_pd(v, 1);
+		const __m128d s = _mm_add_pd(lo, hi);
+		return _mm_cvtsd_f64(_mm_add_sd(s, _mm_unpackhi_pd(s, s)));
+	}
+
+	NL_TARGET_AVX2 inline std::int64_t hsum(__m256i v)
+	{
+		alignas(32) std::int64_t lanes[4];
+		_mm256_store_si256(reinterpret_cast<__m256i*>(lanes), v);
+		return (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+	}
+
+	NL_TARGET_AVX2 double sum_avx2(const double* data, size_t size)
+	{
+		__m256d a0 = _mm256_setzero_pd(), a1 = _mm256_setzero_pd();
+		size_t i = 0;
+		for (; i + 8 <= size; i += 8){
+			a0 = _mm256_add_pd(a0, _mm256_loadu_pd(data + i));
+			a1 = _mm256_add_pd(a1, _mm256_loadu_pd(data + i + 4));
+		}
+		double total = hsum(_mm256_add_pd(a0, a1));
+		for (; i < size; i++) total += data[i];
+		return total;
+	}
+
+	NL_TARGET_AVX2 double sum_avx2(const float* data, size_t size)
+	{
+		__m256d a0 = _mm256_setzero_pd(), a1 = _mm256_setzero_pd();
+		size_t i = 0;
+		for (; i + 8 <= size; i += 8){
+			const __m256 v = _mm256_loadu_ps(data + i);
+			a0 = _mm256_add_pd(a0, _mm256_cvtps_pd(_mm256_castps256_ps128(v)));
+			a1 = _mm256_add_pd(a1, _mm256_cvtps_pd(_mm256_extractf128_ps(v, 1)));
+		}
+		double total = hsum(_mm256_add_pd(a0, a1));
+		for (; i < size; i++) total += data[i];
+		return total;
+	}
+
+	NL_TARGET_AVX2 std::int64_t sum_avx2(const std::int32_t* data, size_t size)
+	{
+		__m256i a0 = _mm256_setzero_si256(), a1 = _mm256_setzero_si256();
+		size_t i = 0;
+		for (; i + 8 <= size; i += 8){
+			const __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i));
+			a0 = _mm256_add_epi64(a0, _mm256_cvtepi32_epi64(_mm256_castsi256_si128(v)));
+			a1 = _mm256_add_epi64(a1, _mm256_cvtepi32_epi64(_mm256_extracti128_si256(v, 1)));
+		}
+		std::int64_t total = hsum(_mm256_add_epi64(a0, a1));
+		for (; i < size; i++) total += data[i];
+		return total;
+	}
+
+	NL_TARGET_AVX2 std::int64_t sum_avx2(const std::int64_t* data, size_t size)
+	{
+		__m256i a0 = _mm256_setzero_si256(), a1 = _mm256_setzero_si256();
+		size_t i = 0;
+		for (; i + 8 <= size; i += 8){
+			a0 = _mm256_add_epi64(a0, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i)));
+			a1 = _mm256_add_epi64(a1, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i + 4)));
+		}
+		std::int64_t total = hsum(_mm256_add_epi64(a0, a1));
+		for (; i < size; i++) total += data[i];
+		return total;
+	}
+
+	//the min_max kernels need size >= one vector, the caller checks
+	NL_TARGET_AVX2 std::pair<double, double> min_max_avx2(const double* data, size_t size)
+	{
+		__m256d lo = _mm256_loadu_pd(data), hi = lo;
+		size_t i = 4;
+		for (; i + 4 <= size; i += 4){
+			const __m256d v = _mm256_loadu_pd(data + i);
+			lo = _mm256_min_pd(lo, v);
+			hi = _mm256_max_pd(hi, v);
+		}
+		alignas(32) double l[4], h[4];
+		_mm256_store_pd(l, lo);
+		_mm256_store_pd(h, hi);
+		std::pair<double, double> result{ std::min({ l[0], l[1], l[2], l[3] }), std::max({ h[0], h[1], h[2], h[3] }) };
+		for (; i < size; i++){
+			if (data[i] < result.first) result.first = data[i];
+			if (result.second < data[i]) result.second = data[i];
+		}
+		return result;
+	}
+
+	NL_TARGET_AVX2 std::pair<float, float> min_max_avx2(const float* data, size_t size)
+	{
+		__m256 lo = _mm256_loadu_ps(data), hi = lo;
+		size_t i = 8;
+		for (; i + 8 <= size; i += 8){
+			const __m256 v = _mm256_loadu_ps(data + i);
+			lo = _mm256_min_ps(lo, v);
+			hi = _mm256_max_ps(hi, v);
+		}
+		alignas(32) float l[8], h[8];
+		_mm256_store_ps(l, lo);
+		_mm256_store_ps(h, hi);
+		std::pair<float, float> result{ *std::min_element(l, l + 8), *std::max_element(h, h + 8) };
+		for (; i < size; i++){
+			if (data[i] < result.first) result.first = data[i];
+			if (result.second < data[i]) result.second = data[i];
+		}
+		return result;
+	}
+
+	NL_TARGET_AVX2 std::pair<std::int32_t, std::int32_t> min_max_avx2(const std::int32_t* data, size_t size)
+	{
+		__m256i lo = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data)), hi = lo;
+		size_t i = 8;
+		for (; i + 8 <= size; i += 8){
+			const __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i));
+			lo = _mm256_min_epi32(lo, v);
+			hi = _mm256_max_epi32(hi, v);
+		}
+		alignas(32) std::int32_t l[8], h[8];
+		_mm256_store_si256(reinterpret_cast<__m256i*>(l), lo);
+		_mm256_store_si256(reinterpret_cast<__m256i*>(h), hi);
+		std::pair<std::int32_t, std::int32_t> result{ *std::min_element(l, l + 8), *std::max_element(h, h + 8) };
+		for (; i < size; i++){
+			if (data[i] < result.first) result.first = data[i];
+			if (result.second < data[i]) result.second = data[i];
+		}
+		return result;
+	}
+
+	NL_TARGET_AVX2 std::pair<std::int64_t, std::int64_t> min_max_avx2(const std::int64_t* data, size_t size)
+	{
+		//no 64 bit min and max in AVX2, compare and blend instead
+		__m256i lo = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data)), hi = lo;
+		size_t i = 4;
+		for (; i + 4 <= size; i += 4){
+			const __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i));
+			lo = _mm256_blendv_epi8(lo, v, _mm256_cmpgt_epi64(lo, v));
+			hi = _mm256_blendv_epi8(hi, v, _mm256_cmpgt_epi64(v, hi));
+		}
+		alignas(32) std::int64_t l[4], h[4];
+		_mm256_store_si256(reinterpret_cast<__m256i*>(l), lo);
+		_mm256_store_si256(reinterpret_cast<__m256i*>(h), hi);
+		std::pair<std::int64_t, std::int64_t> result{ std::min({ l[0], l[1], l[2], l[3] }), std::max({ h[0], h[1], h[2], h[3] }) };
+		for (; i < size; i++){
+			if (data[i] < result.first) result.first = data[i];
+			if (result.second < data[i]) result.second = data[i];
+		}
+		return result;
+	}
+
+	NL_TARGET_AVX2 double squared_deviation_avx2(const double* data, size_t size, double mean)
+	{
+		const __m256d m = _mm256_set1_pd(mean);
+		__m256d a0 = _mm256_setzero_pd(), a1 = _mm256_setzero_pd();
+		size_t i = 0;
+		for (; i + 8 <= size; i += 8){
+			const __m256d d0 = _mm256_sub_pd(_mm256_loadu_pd(data + i), m);
+			const __m256d d1 = _mm256_sub_pd(_mm256_loadu_pd(data + i + 4), m);
+			a0 = _mm256_add_pd(a0, _mm256_mul_pd(d0, d0));
+			a1 = _mm256_add_pd(a1, _mm256_mul_pd(d1, d1));
+		}
+		double total = hsum(_mm256_add_pd(a0, a1));
+		for (; i < size; i++){
+			const double d = data[i] - mean;
+			total += d * d;
+		}
+		return total;
+	}
+
+	NL_TARGET_AVX2 double squared_deviation_avx2(const float* data, size_t size, double mean)
+	{
+		const __m256d m = _mm256_set1_pd(mean);
+		__m256d a0 = _mm256_setzero_pd(), a1 = _mm256_setzero_pd();
+		size_t i = 0;
+		for (; i + 8 <= size; i += 8){
+			const __m256 v = _mm256_loadu_ps(data + i);
+			const __m256d d0 = _mm256_sub_pd(_mm256_cvtps_pd(_mm256_castps256_ps128(v)), m);
+			const __m256d d1 = _mm256_sub_pd(_mm256_cvtps_pd(_mm256_extractf128_ps(v, 1)), m);
+			a0 = _mm256_add_pd(a0, _mm256_mul_pd(d0, d0));
+			a1 = _mm256_add_pd(a1, _mm256_mul_pd(d1, d1));
+		}
+		double total = hsum(_mm256_add_pd(a0, a1));
+		for (; i < size; i++){
+			const double d = static_cast<double>(data[i]) - mean;
+			total += d * d;
+		}
+		return total;
+	}
+#endif
+
+	template<typename T>
+	nl::kernel::sum_t<T> dispatch_sum(const T* data, size_t size)
+	{
+#if NL_KERNEL_X86
+		if (avx2_enabled()) return sum_avx2(data, size);
+#endif
+		return nl::kernel::detail::scalar_sum(data, size);
+	}
+
+	template<typename T>
+	std::pair<T, T> dispatch_min_max(const T* data, size_t size)
+	{
+		if (size == 0) return std::make_pair(T{}, T{});
+#if NL_KERNEL_X86
+		if (avx2_enabled() && size >= 32 / sizeof(T)) return min_max_avx2(data, size);
+#endif
+		return nl::kernel::detail::scalar_min_max(data, data + size, nl::kernel::detail::identity{});
+	}
+
+	template<typename T>
+	double dispatch_squared_deviation(const T* data, size_t size, double mean)
+	{
+#if NL_KERNEL_X86
+		if (avx2_enabled()) return squared_deviation_avx2(data, size, mean);
+#endif
+		return scalar_squared_deviation(data, size, mean);
+	}
+};
+
+bool nl::kernel::has_avx2()
+{
+	return avx2_enabled();
+}
+
+double nl::kernel::sum(const double* data, size_t size)
+{
+	return dispatch_sum(data, size);
+}
+
+double nl::kernel::sum(const float* data, size_t size)
+{
+	return dispatch_sum(data, size);
+}
+
+std::int64_t nl::kernel::sum(const std::int32_t* data, size_t size)
+{
+	return dispatch_sum(data, size);
+}
+
+std::int64_t nl::kernel::sum(const std::int64_t* data, size_t size)
+{
+	return dispatch_sum(data, size);
+}
+
+std::pair<double, double> nl::kernel::min_max(const double* data, size_t size)
+{
+	return dispatch_min_max(data, size);
+}
+
+std::pair<float, float> nl::kernel::min_max(const float* data, size_t size)
+{
+	return dispatch_min_max(data, size);
+}
+
+std::pair<std::int32_t, std::int32_t> nl::kernel::min_max(const std::int32_t* data, size_t size)
+{
+	return dispatch_min_max(data, size);
+}
+
+std::pair<std::int64_t, std::int64_t> nl::kernel::min_max(const std::int64_t* data, size_t size)
+{
+	return dispatch_min_max(data, size);
+}
+
+double nl::kernel::sum_squared_deviation(const double* data, size_t size, double mean)
+{
+	return dispatch_squared_deviation(data, size, mean);
+}
+
+double nl::kernel::sum_squared_deviation(const float* data, size_t size, double mean)
+{
+	return dispatch_squared_deviation(data, size, mean);
+}
@@ -0,0 +1,192 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include <iterator>
+#include <utility>
+#include <type_traits>
+/*
+	aggregate kernels over a column of arithmetic values: sum, average, min_max, count_if and variance
+	the pointer overloads expect the column to be contiguous (column_relation::column<I>(), a std::vector)
+	for double, float, int32 and int64 they run on AVX2 when the cpu has it, checked once at run time,
+	other cpus and other types take the scalar loops, written with independent accumulators so the compiler can vectorize them
+	the range overloads with a projection are for row relations, the values are spread over the tuples so they are always scalar
+	AVX2 adds the values in a different order than the scalar loop, floating point results can differ in the last bits
+	sums of integers are done in 64 bit, sums of floats in double
+*/
+
+namespace nl
+{
+	namespace kernel
+	{
+		template<typename T>
+		using sum_t = std::conditional_t<std::is_floating_point_v<T>, double,
+			std::conditional_t<std::is_signed_v<T>, std::int64_t, std::uint64_t>>;
+
+		//true if the aggregate kernels use AVX2 on this cpu
+		bool has_avx2();
+
+		double sum(const double* data, size_t size);
+		double sum(const float* data, size_t size);
+		std::int64_t sum(const std::int32_t* data, size_t size);
+		std::int64_t sum(const std::int64_t* data, size_t size);
+
+		std::pair<double, double> min_max(const double* data, size_t size);
+		std::pair<float, float> min_max(const float* data, size_t size);
+		std::pair<std::int32_t, std::int32_t> min_max(const std::int32_t* data, size_t size);
+		std::pair<std::int64_t, std::int64_t> min_max(const std::int64_t* data, size_t size);
+
+		//sum of (x - mean)^2
+		double sum_squared_deviation(const double* data, size_t size, double mean);
+		double sum_squared_deviation(const float* data, size_t size, double mean);
+
+		namespace detail
+		{
+			template<typename T>
+			constexpr bool has_simd_v = std::is_same_v<T, double> || std::is_same_v<T, float>
+				|| std::is_same_v<T, std::int32_t> || std::is_same_v<T, std::int64_t>;
+
+			template<typename T>
+			constexpr bool has_simd_deviation_v = std::is_same_v<T, double> || std::is_same_v<T, float>;
+
+			template<typename Iter, typename Proj>
+			sum_t<std::decay_t<std::invoke_result_t<Proj, decltype(*std::declval<Iter>())>>> scalar_sum(Iter first, Iter last, Proj proj)
+			{
+				using value_t = std::decay_t<std::invoke_result_t<Proj, decltype(*std::declval<Iter>())>>;
+				sum_t<value_t> total{};
+				for (; first != last; ++first){
+					total += static_cast<sum_t<value_t>>(proj(*first));
+				}
+				return total;
+			}
+
+			template<typename T>
+			sum_t<T> scalar_sum(const T* data, size_t size)
+			{
+				//four chains so the adds do not wait on each other
+				sum_t<T> s0{}, s1{}, s2{}, s3{};
+				size_t i = 0;
+				for (; i + 4 <= size; i += 4){
+					s0 += static_cast<sum_t<T>>(data[i]);
+					s1 += static_cast<sum_t<T>>(data[i + 1]);
+					s2 += static_cast<sum_t<T>>(data[i + 2]);
+					s3 += static_cast<sum_t<T>>(data[i + 3]);
+				}
+				for (; i < size; i++){
+					s0 += static_cast<sum_t<T>>(data[i]);
+				}
+				return (s0 + s1) + (s2 + s3);
+			}
+
+			template<typename Iter, typename Proj>
+			auto scalar_min_max(Iter first, Iter last, Proj proj)
+			{
+				using value_t = std::decay_t<std::invoke_result_t<Proj, decltype(*std::declval<Iter>())>>;
+				if (first == last) return std::make_pair(value_t{}, value_t{});
+				value_t lo = proj(*first);
+				value_t hi = lo;
+				for (++first; first != last; ++first){
+					const value_t& value = proj(*first);
+					if (value < lo) lo = value;
+					if (hi < value) hi = value;
+				}
+				return std::make_pair(lo, hi);
+			}
+
+			template<typename Iter, typename Proj>
+			double scalar_squared_deviation(Iter first, Iter last, Proj proj, double mean)
+			{
+				double total = 0.0;
+				for (; first != last; ++first){
+					const double d = static_cast<double>(proj(*first)) - mean;
+					total += d * d;
+				}
+				return total;
+			}
+
+			struct identity
+			{
+				template<typename T>
+				constexpr const T& operator()(const T& value) const noexcept { return value; }
+			};
+		};
+
+		template<typename T>
+		sum_t<T> sum(const T* data, size_t size)
+		{
+			static_assert(std::is_arithmetic_v<T>, "sum needs an arithmetic column");
+			if constexpr (detail::has_simd_v<T>) return sum(data, size);
+			else return detail::scalar_sum(data, size);
+		}
+
+		template<typename T>
+		double average(const T* data, size_t size)
+		{
+			if (size == 0) return 0.0;
+			return static_cast<double>(kernel::sum<T>(data, size)) / static_cast<double>(size);
+		}
+
+		//smallest and largest value, a pair of T{} when size is 0
+		template<typename T>
+		std::pair<T, T> min_max(const T* data, size_t size)
+		{
+			static_assert(std::is_arithmetic_v<T>, "min_max needs an arithmetic column");
+			if (size == 0) return std::make_pair(T{}, T{});
+			if constexpr (detail::has_simd_v<T>) return min_max(data, size);
+			else return detail::scalar_min_max(data, data + size, detail::identity{});
+		}
+
+		//pred is called on every value with no early exit, a branch free predicate lets the loop vectorize
+		template<typename T, typename Pred>
+		size_t count_if(const T* data, size_t size, Pred pred)
+		{
+			size_t count = 0;
+			for (size_t i = 0; i < size; i++){
+				count += static_cast<size_t>(pred(data[i]) ? 1 : 0);
+			}
+			return count;
+		}
+
+		//population variance, two passes, the mean first then the squared deviations
+		template<typename T>
+		double variance(const T* data, size_t size)
+		{
+			static_assert(std::is_arithmetic_v<T>, "variance needs an arithmetic column");
+			if (size == 0) return 0.0;
+			const double mean = kernel::average<T>(data, size);
+			if constexpr (detail::has_simd_deviation_v<T>) return sum_squared_deviation(data, size, mean) / static_cast<double>(size);
+			else return detail::scalar_squared_deviation(data, data + size, detail::identity{}, mean) / static_cast<double>(size);
+		}
+
+		//the same aggregates over a range with a projection, used by row relations
+		template<typename Iter, typename Proj>
+		auto sum(Iter first, Iter last, Proj proj)
+		{
+			return detail::scalar_sum(first, last, proj);
+		}
+
+		template<typename Iter, typename Proj>
+		auto min_max(Iter first, Iter last, Proj proj)
+		{
+			return detail::scalar_min_max(first, last, proj);
+		}
+
+		template<typename Iter, typename Proj, typename Pred>
+		size_t count_if(Iter first, Iter last, Proj proj, Pred pred)
+		{
+			size_t count = 0;
+			for (; first != last; ++first){
+				count += static_cast<size_t>(pred(proj(*first)) ? 1 : 0);
+			}
+			return count;
+		}
+
+		template<typename Iter, typename Proj>
+		double variance(Iter first, Iter last, Proj proj)
+		{
+			const size_t size = static_cast<size_t>(std::distance(first, last));
+			if (size == 0) return 0.0;
+			const double mean = static_cast<double>(detail::scalar_sum(first, last, proj)) / static_cast<double>(size);
+			return detail::scalar_squared_deviation(first, last, proj, mean) / static_cast<double>(size);
+		}
+	};
+};
@@ -0,0 +1,111 @@
+#include "../pch.h"
+#include "async_database.h"
+
+nl::async_database::async_database(const std::filesystem::path& database_file, const database_options& options)
+: m_database(database_file, options){
+	m_worker = std::thread(&async_database::run, this);
+}
+
+nl::async_database::~async_database()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_stop = true;
+	}
+	m_job_ready.notify_one();
+	//jobs already queued are run before the worker exits
+	if (m_worker.joinable()){
+		m_worker.join();
+	}
+}
+
+std::future<nl::database::statement_index> nl::async_database::prepare_query(const nl::query& query)
+{
+	return submit([text = query.get_query()](nl::database& db) { return db.prepare_query(text); });
+}
+
+void nl::async_database::push(job&& j)
+{
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		assert(!m_stop && "Job pushed into a stopped async_database");
+		m_jobs.push_back(std::move(j));
+	}
+	m_job_ready.notify_one();
+}
+
+void nl::async_database::run()
+{
+	std::vector<job> jobs;
+	jobs.reserve(max_coalesced_writes);
+	while (true){
+		jobs.clear();
+		{
+			std::unique_lock<std::mutex> lock(m_mutex);
+			m_job_ready.wait(lock, [this]() { return (m_stop || !m_jobs.empty()); });
+			if (m_jobs.empty()) return;
+
+			//a read runs alone, a write takes every write queued right behind it, reads keep their place in the order
+			jobs.push_back(std::move(m_jobs.front()));
+			m_jobs.pop_front();
+			while (jobs.front().write && !m_jobs.empty() && m_jobs.front().write && jobs.size() < max_coalesced_writes){
+				jobs.push_back(std::move(m_jobs.front()));
+				m_jobs.pop_front();
+			}
+		}
+		if (jobs.front().write){
+			run_writes(jobs);
+		}
+		else{
+			//both submit()s hand the job's exceptions to the caller, this only keeps the worker alive if posting the handler throws
+			try {
+				jobs.front().run(m_database);
+			}
+			catch (...) {}
+		}
+	}
+}
+
+void nl::async_database::run_writes(std::vector<job>& writes)
+{
+	auto run_job = [this](job& j) -> bool {
+		try {
+			return j.run(m_database);
+		}
+		catch (...) {
+			return false;
+		}
+	};
+
+	if (writes.size() == 1){
+		//nothing to coalesce, the write uses its own transaction
+		writes.front().complete(run_job(writes.front()));
+		return;
+	}
+
+	nl::database::transaction batch(m_database, nl::database::transaction::immediate);
+	if (!batch.is_open()){
+		for (auto& write : writes){
+			write.complete(run_job(write));
+		}
+		return;
+	}
+	std::vector<bool> results(writes.size(), false);
+	for (size_t i = 0; i < writes.size(); i++){
+		//a failed write only undoes its own savepoint, the rest of the batch still commits
+		nl::database::transaction savepoint(m_database);
+		if (run_job(writes[i])){
+			results[i] = savepoint.commit();
+		}
+		else{
+			savepoint.rollback();
+		}
+	}
+	const bool committed = batch.commit();
+	if (!committed){
+		batch.rollback();
+	}
+	for (size_t i = 0; i < writes.size(); i++){
+		writes[i].complete(results[i] && committed);
+	}
+}
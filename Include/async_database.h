@@ -0,0 +1,179 @@
+#pragma once
+#include <future>
+#include <memory>
+#include <exception>
+#include <deque>
+#include <functional>
+#include <condition_variable>
+#include <boost/asio/post.hpp>
+
+#include "Database.h"
+/*
+	runs a database connection on its own worker thread so that callers never block on sqlite3_step
+	jobs are queued and run in order, results come back through a std::future or
+	are posted as a completion handler to an asio executor (the io_context of nl::session for example)
+	write jobs that are queued back to back are run in one transaction, each inside its own savepoint,
+	so a burst of small inserts costs one commit instead of one per insert
+	the connection is only touched from the worker thread, prepare statements through prepare_query
+	a job must never wait on a future from its own async_database, the worker would be waiting on itself
+*/
+
+namespace nl
+{
+	class async_database
+	{
+	public:
+		//upper bound on the writes committed together
+		constexpr static size_t max_coalesced_writes = 256;
+
+		explicit async_database(const std::filesystem::path& database_file, const database_options& options = {});
+		~async_database();
+
+		//runs func(database&) on the worker thread, the future holds what func returns or what it threw
+		template<typename Func>
+		auto submit(Func&& func) -> std::future<std::invoke_result_t<Func, nl::database&>>
+		{
+			using result_t = std::invoke_result_t<Func, nl::database&>;
+			auto promise = std::make_shared<std::promise<result_t>>();
+			auto future = promise->get_future();
+			push(job{ [promise, func = share(std::forward<Func>(func))](nl::database& db) mutable -> bool {
+				try {
+					if constexpr (std::is_void_v<result_t>){
+						(*func)(db);
+						promise->set_value();
+					}
+					else {
+						promise->set_value((*func)(db));
+					}
+				}
+				catch (...) {
+					promise->set_exception(std::current_exception());
+				}
+				return true;
+			}, nullptr, false });
+			return future;
+		}
+
+		//same as submit but the result is passed to handler on executor, error first like asio handlers
+		//handler(std::exception_ptr, result), or handler(std::exception_ptr) when func returns void
+		//if func throws, the exception_ptr is set and the result is value initialized
+		template<typename Func, typename Executor, typename Handler>
+		void submit(Func&& func, const Executor& executor, Handler&& handler)
+		{
+			using result_t = std::invoke_result_t<Func, nl::database&>;
+			push(job{ [func = share(std::forward<Func>(func)), executor, handler = share(std::forward<Handler>(handler))](nl::database& db) mutable -> bool {
+				//a job runs once, so the handler is moved out of its shared state into the posted call
+				if constexpr (std::is_void_v<result_t>){
+					std::exception_ptr error{};
+					try {
+						(*func)(db);
+					}
+					catch (...) {
+						error = std::current_exception();
+					}
+					boost::asio::post(executor, [handler = std::move(*handler), error]() mutable { handler(error); });
+				}
+				else {
+					std::exception_ptr error{};
+					result_t result{};
+					try {
+						result = (*func)(db);
+					}
+					catch (...) {
+						error = std::current_exception();
+					}
+					boost::asio::post(executor, [handler = std::move(*handler), error, result = std::move(result)]() mutable { handler(error, std::move(result)); });
+				}
+				return true;
+			}, nullptr, false });
+		}
+
+		//func(database&) returns bool, it may be coalesced with other writes into one transaction
+		//the future is only set to true once the transaction it ran in has committed
+		template<typename Func>
+		std::future<bool> submit_write(Func&& func)
+		{
+			auto promise = std::make_shared<std::promise<bool>>();
+			auto future = promise->get_future();
+			push(job{ [func = share(std::forward<Func>(func))](nl::database& db) { return (*func)(db); }, [promise](bool done) { promise->set_value(done); }, true });
+			return future;
+		}
+
+		template<typename Func, typename Executor, typename Handler>
+		void submit_write(Func&& func, const Executor& executor, Handler&& handler)
+		{
+			push(job{ [func = share(std::forward<Func>(func))](nl::database& db) { return (*func)(db); },
+				[executor, handler = share(std::forward<Handler>(handler))](bool done) {
+				boost::asio::post(executor, [handler = std::move(*handler), done]() mutable { handler(done); });
+			}, true });
+		}
+
+		std::future<nl::database::statement_index> prepare_query(const nl::query& query);
+
+		template<typename relation>
+		std::future<relation> retrive(nl::database::statement_index index)
+		{
+			return submit([index](nl::database& db) { return db.retrive<relation>(index); });
+		}
+
+		//handler(std::exception_ptr, relation)
+		template<typename relation, typename Executor, typename Handler>
+		void retrive(nl::database::statement_index index, const Executor& executor, Handler&& handler)
+		{
+			submit([index](nl::database& db) { return db.retrive<relation>(index); }, executor, std::forward<Handler>(handler));
+		}
+
+		//the relation is copied into the job, the caller's relation can go away before the insert runs
+		template<typename relation>
+		std::future<bool> insert(nl::database::statement_index index, relation rel)
+		{
+			return submit_write([index, rel = std::move(rel)](nl::database& db) { return db.insert(index, rel); });
+		}
+
+		template<typename relation, typename Executor, typename Handler>
+		void insert(nl::database::statement_index index, relation rel, const Executor& executor, Handler&& handler)
+		{
+			submit_write([index, rel = std::move(rel)](nl::database& db) { return db.insert(index, rel); }, executor, std::forward<Handler>(handler));
+		}
+
+		template<typename row_t, typename... T>
+		std::future<bool> update(nl::database::statement_index index, row_t row, T... args)
+		{
+			return submit_write([index, row = std::move(row), args...](nl::database& db) mutable { return db.update<row_t>(index, row, args...); });
+		}
+
+		inline std::thread::id get_worker_id() const { return m_worker.get_id(); }
+
+	private:
+		//std::function only holds copyable callables, move only funcs and handlers are kept behind a shared_ptr instead
+		template<typename T>
+		static std::shared_ptr<std::decay_t<T>> share(T&& value)
+		{
+			return std::make_shared<std::decay_t<T>>(std::forward<T>(value));
+		}
+
+		struct job
+		{
+			//returns false when a write failed, the savepoint it ran in is rolled back
+			std::function<bool(nl::database&)> run;
+			//only for writes, called with the final outcome after the transaction is done
+			std::function<void(bool)> complete;
+			bool write{ false };
+		};
+
+		async_database(const async_database&) = delete;
+		async_database& operator=(const async_database&) = delete;
+
+		void push(job&& j);
+		void run();
+		void run_writes(std::vector<job>& writes);
+
+		nl::database m_database;
+		std::deque<job> m_jobs{};
+		std::mutex m_mutex{};
+		std::condition_variable m_job_ready{};
+		bool m_stop{ false };
+		//last so that everything it uses is constructed before it starts
+		std::thread m_worker{};
+	};
+};
@@ -0,0 +1,434 @@
+#pragma once
+#include <vector>
+#include <cassert>
+#include <tuple>
+#include <numeric>
+#include <algorithm>
+#include <unordered_map>
+#include <execution>
+#include <type_traits>
+
+#include "relation.h"
+#include "aggregate_kernels.h"
+	/////////////////////////////////////////////////////////////
+	// column_relation stores a relation column by column (struct of arrays) instead of row by row
+	// every column is its own contiguous std::vector, so a scan, aggregate or filter over one column
+	// only touches that column's memory and runs at memory bandwidth on wide tables
+	// rows are still the unit for add, push_back and iteration, iterating gives a tuple of references into the columns
+	// it plugs into database::retrive, database::insert and relation_buffer like a vector_relation
+	// the row operations (add, order_by, where on whole rows) touch every column and cost more than on a vector_relation
+
+namespace nl
+{
+	namespace detail
+	{
+		//the column_relation with the columns of a tuple type
+		template<typename tuple_t>
+		struct column_relation_of;
+	};
+
+	template<typename... val>
+	class column_relation : public base_relation
+	{
+		//std::vector<bool> packs its bits, a column of it has no data() for the kernels and no const bool& for ref_tuple_t
+		static_assert((!std::is_same_v<val, bool> && ...), "column_relation cannot store bool columns, use std::uint8_t");
+	public:
+		using tuple_t = std::tuple<val...>;
+		using row_t = tuple_t;
+		//a row read in place, the references point into the columns and are invalidated when the relation grows
+		using ref_tuple_t = std::tuple<const val&...>;
+		using columns_t = std::tuple<std::vector<val>...>;
+		using container_tag = columnar_relation_tag;
+		using relation_t = column_relation;
+
+		template<size_t I>
+		using elem_t = std::tuple_element_t<I, tuple_t>;
+		template<size_t I>
+		using column_t = std::vector<elem_t<I>>;
+		constexpr static size_t column_count = sizeof...(val);
+
+		//random access over the rows, dereferencing gives a ref_tuple_t
+		class const_iterator
+		{
+		public:
+			using iterator_category = std::random_access_iterator_tag;
+			using value_type = tuple_t;
+			using difference_type = std::ptrdiff_t;
+			using reference = ref_tuple_t;
+			using pointer = void;
+
+			const_iterator() = default;
+			const_iterator(const column_relation* rel, size_t row) : m_relation(rel), m_row(row) {}
+
+			inline reference operator*() const { return m_relation->row_ref(m_row); }
+			inline reference operator[](difference_type n) const { return m_relation->row_ref(m_row + n); }
+			inline const_iterator& operator++() { ++m_row; return (*this); }
+			inline const_iterator operator++(int) { const_iterator it = *this; ++m_row; return it; }
+			inline const_iterator& operator--() { --m_row; return (*this); }
+			inline const_iterator operator--(int) { const_iterator it = *this; --m_row; return it; }
+			inline const_iterator& operator+=(difference_type n) { m_row += n; return (*this); }
+			inline const_iterator& operator-=(difference_type n) { m_row -= n; return (*this); }
+			inline const_iterator operator+(difference_type n) const { return const_iterator(m_relation, m_row + n); }
+			inline const_iterator operator-(difference_type n) const { return const_iterator(m_relation, m_row - n); }
+			inline difference_type operator-(const const_iterator& rhs) const { return static_cast<difference_type>(m_row) - static_cast<difference_type>(rhs.m_row); }
+			inline bool operator==(const const_iterator& rhs) const { return m_row == rhs.m_row; }
+			inline bool operator!=(const const_iterator& rhs) const { return m_row != rhs.m_row; }
+			inline bool operator<(const const_iterator& rhs) const { return m_row < rhs.m_row; }
+			inline bool operator>(const const_iterator& rhs) const { return m_row > rhs.m_row; }
+			inline bool operator<=(const const_iterator& rhs) const { return m_row <= rhs.m_row; }
+			inline bool operator>=(const const_iterator& rhs) const { return m_row >= rhs.m_row; }
+			inline size_t index() const { return m_row; }
+
+		private:
+			const column_relation* m_relation{ nullptr };
+			size_t m_row{ 0 };
+		};
+		using iterator = const_iterator;
+
+		column_relation() = default;
+		explicit column_relation(size_t size) { resize(size); }
+		virtual ~column_relation() {}
+
+		inline size_t size() const { return std::get<0>(m_columns).size(); }
+		inline bool empty() const { return std::get<0>(m_columns).empty(); }
+		inline void reserve(size_t size) { std::apply([size](auto&... col) { (col.reserve(size), ...); }, m_columns); }
+		inline void resize(size_t size) { std::apply([size](auto&... col) { (col.resize(size), ...); }, m_columns); }
+		inline void clear() { std::apply([](auto&... col) { (col.clear(), ...); }, m_columns); }
+		inline void shrink_to_fit() { std::apply([](auto&... col) { (col.shrink_to_fit(), ...); }, m_columns); }
+		inline constexpr size_t get_column_count() const { return column_count; }
+
+		inline const_iterator begin() const { return const_iterator(this, 0); }
+		inline const_iterator end() const { return const_iterator(this, size()); }
+		inline const_iterator cbegin() const { return begin(); }
+		inline const_iterator cend() const { return end(); }
+
+		//the whole column as one contiguous array
+		template<size_t I>
+		inline const column_t<I>& column() const { return std::get<I>(m_columns); }
+		template<size_t I>
+		inline column_t<I>& column() { return std::get<I>(m_columns); }
+
+		inline void push_back(const tuple_t& row) { push_back_row(row, std::index_sequence_for<val...>{}); }
+		inline void push_back(tuple_t&& row) { push_back_row(std::move(row), std::index_sequence_for<val...>{}); }
+
+		inline const_iterator add(const val& ... args)
+		{
+			push_back_row(std::forward_as_tuple(args...), std::index_sequence_for<val...>{});
+			return (end() - 1);
+		}
+
+		inline const_iterator add(const row_t& row)
+		{
+			push_back(row);
+			return (end() - 1);
+		}
+
+		inline size_t append_relation(const relation_t& rel)
+		{
+			append_columns(rel, std::index_sequence_for<val...>{});
+			return size();
+		}
+
+		inline void del_back() { std::apply([](auto&... col) { (col.pop_back(), ...); }, m_columns); }
+
+		inline void del_row(size_t row)
+		{
+			assert(row < size() && "Row is out of range");
+			std::apply([row](auto&... col) { (col.erase(col.begin() + row), ...); }, m_columns);
+		}
+
+		template<size_t col>
+		inline const elem_t<col>& get(size_t row) const
+		{
+			assert(row < size() && "Row is out of range");
+			return std::get<col>(m_columns)[row];
+		}
+
+		template<size_t col>
+		inline void set(size_t row, const elem_t<col>& value)
+		{
+			assert(row < size() && "Row is out of range");
+			std::get<col>(m_columns)[row] = value;
+		}
+
+		//a copy of the row
+		inline tuple_t tuple_at(size_t row) const
+		{
+			return std::apply([row](const auto&... col) { return tuple_t(col[row]...); }, m_columns);
+		}
+
+		inline ref_tuple_t row_ref(size_t row) const
+		{
+			return std::apply([row](const auto&... col) { return ref_tuple_t(col[row]...); }, m_columns);
+		}
+
+		//the aggregates run over the contiguous column, AVX2 when the cpu has it, see aggregate_kernels.h
+		template<size_t I>
+		inline auto sum() const
+		{
+			const column_t<I>& col = column<I>();
+			return kernel::sum(col.data(), col.size());
+		}
+
+		template<size_t I>
+		inline double average() const
+		{
+			const column_t<I>& col = column<I>();
+			return kernel::average(col.data(), col.size());
+		}
+
+		//smallest and largest value in column I, a pair of default values when the relation is empty
+		template<size_t I>
+		inline std::pair<elem_t<I>, elem_t<I>> min_max() const
+		{
+			const column_t<I>& col = column<I>();
+			return kernel::min_max(col.data(), col.size());
+		}
+
+		template<size_t I, typename Pred>
+		inline size_t count_if(Pred pred) const
+		{
+			const column_t<I>& col = column<I>();
+			return kernel::count_if(col.data(), col.size(), pred);
+		}
+
+		template<size_t I>
+		inline double variance() const
+		{
+			const column_t<I>& col = column<I>();
+			return kernel::variance(col.data(), col.size());
+		}
+
+		//iterators to the smallest and largest value in column I
+		template<size_t I>
+		inline auto min_max_on() const noexcept
+		{
+			const column_t<I>& col = column<I>();
+			return std::minmax_element(col.begin(), col.end());
+		}
+
+		template<size_t I>
+		inline column_t<I> isolate_column() const
+		{
+			return column<I>();
+		}
+
+		template<size_t col>
+		inline const_iterator find_on(const elem_t<col>& value) const noexcept
+		{
+			const column_t<col>& c = column<col>();
+			return const_iterator(this, static_cast<size_t>(std::distance(c.begin(), std::find(c.begin(), c.end(), value))));
+		}
+
+		//rows for which pred(row) is true, pred gets a ref_tuple_t
+		template<typename Pred>
+		auto where(Pred pred) const
+		{
+			std::vector<size_t> rows;
+			rows.reserve(size());
+			for (size_t i = 0; i < size(); i++)
+			{
+				if (pred(row_ref(i))) rows.push_back(i);
+			}
+			return gather(rows);
+		}
+
+		//rows for which pred(value of column I) is true, only column I is scanned
+		template<size_t I, typename Pred>
+		auto where(Pred pred) const
+		{
+			const column_t<I>& col = column<I>();
+			std::vector<size_t> rows;
+			rows.reserve(col.size());
+			for (size_t i = 0; i < col.size(); i++)
+			{
+				if (pred(col[i])) rows.push_back(i);
+			}
+			return gather(rows);
+		}
+
+		//sorts once on an index, then moves every column into the sorted order
+		template<size_t I, typename order = order_asc<elem_t<I>>>
+		void order_by()
+		{
+			const column_t<I>& key = column<I>();
+			std::vector<size_t> rows(size());
+			std::iota(rows.begin(), rows.end(), size_t(0));
+			std::stable_sort(rows.begin(), rows.end(), [&](size_t l, size_t r) {
+				return order{}(key[l], key[r]);
+			});
+			permute(rows);
+		}
+
+		template<size_t...I>
+		inline auto select() const
+		{
+			column_relation<elem_t<I>...> new_relation;
+			new_relation.m_columns = std::make_tuple(std::get<I>(m_columns)...);
+			return new_relation;
+		}
+
+		//each selected column is copied whole, the copy of a column is split across the cores
+		template<size_t...I, typename execution_policy = std::execution::parallel_policy>
+		inline auto select_par(execution_policy policy = std::execution::par) const
+		{
+			column_relation<elem_t<I>...> new_relation(size());
+			copy_columns_par<0, I...>(new_relation, policy);
+			return new_relation;
+		}
+
+		//one row per distinct value of column KeyCol, the key then one value per aggregate, see group_aggregate.h
+		//the key is read straight from its column, an execution policy can be passed first, par by default
+		template<size_t KeyCol, typename First, typename... Rest>
+		auto group_aggregate(const First& first, const Rest&... rest) const
+		{
+			if constexpr (std::is_execution_policy_v<First>) return do_group_aggregate<KeyCol>(first, rest...);
+			else return do_group_aggregate<KeyCol>(std::execution::par, first, rest...);
+		}
+
+		//joins on column I1 of this and column I2 of rel, rel can be a column_relation or a vector relation
+		//every pair of rows with equal keys is in the result, so duplicate keys on either side are kept
+		template<size_t I1, size_t I2, typename rel_t>
+		inline auto join_on(const rel_t& rel) const
+		{
+			using rel_tuple_t = typename rel_t::tuple_t;
+			using key_t = std::tuple_element_t<I2, rel_tuple_t>;
+			static_assert(std::is_same_v<elem_t<I1>, key_t> || std::is_convertible_v<elem_t<I1>, key_t>,
+				"Cannot join on column that are not same type or the types are not convertible");
+			using type = typename detail::join_tuple_type<tuple_t, rel_tuple_t>::type;
+			typename detail::column_relation_of<type>::type new_relation;
+			new_relation.reserve(size());
+
+			const detail::row_access<rel_t> right(rel);
+			std::unordered_multimap<key_t, size_t> find_map;
+			find_map.reserve(right.size());
+			for (size_t j = 0; j < right.size(); j++)
+			{
+				find_map.emplace(std::get<I2>(right[j]), j);
+			}
+			const column_t<I1>& key = column<I1>();
+			for (size_t i = 0; i < key.size(); i++)
+			{
+				auto [first, last] = find_map.equal_range(key[i]);
+				for (; first != last; ++first)
+				{
+					new_relation.push_back(std::tuple_cat(tuple_at(i), rel_tuple_t(right[first->second])));
+				}
+			}
+			return new_relation;
+		}
+
+		//the parallel version of join_on, a partitioned hash join over the key column, see hash_join.h
+		//rows come out grouped by hash partition, not in the order of this relation
+		template<size_t I1, size_t I2, typename rel_t, typename execution_policy = std::execution::parallel_policy>
+		inline auto join_on_par(const rel_t& rel, execution_policy policy = std::execution::par) const
+		{
+			using rel_tuple_t = typename rel_t::tuple_t;
+			using key_t = std::tuple_element_t<I2, rel_tuple_t>;
+			static_assert(std::is_same_v<elem_t<I1>, key_t> || std::is_convertible_v<elem_t<I1>, key_t>,
+				"Cannot join on column that are not same type or the types are not convertible");
+			using type = typename detail::join_tuple_type<tuple_t, rel_tuple_t>::type;
+			typename detail::column_relation_of<type>::type new_relation;
+
+			const column_t<I1>& key = column<I1>();
+			const detail::row_access<rel_t> right(rel);
+			auto parts = detail::hash_join<type, key_t>(
+				key.size(), [&](size_t row) -> const elem_t<I1>& { return key[row]; },
+				right.size(), [&](size_t row) -> decltype(auto) { return std::get<I2>(right[row]); },
+				[&](size_t l, size_t r) { return type(std::tuple_cat(tuple_at(l), rel_tuple_t(right[r]))); },
+				policy);
+			detail::append_partitions(new_relation, parts, policy);
+			return new_relation;
+		}
+
+	private:
+		template<typename... T>
+		friend class column_relation;
+
+		template<typename row, size_t...I>
+		inline void push_back_row(row&& r, std::index_sequence<I...>)
+		{
+			(std::get<I>(m_columns).push_back(std::get<I>(std::forward<row>(r))), ...);
+		}
+
+		template<size_t To, size_t From, size_t...Rest, typename rel_t, typename execution_policy>
+		inline void copy_columns_par(rel_t& rel, execution_policy policy) const
+		{
+			const column_t<From>& src = column<From>();
+			std::copy(policy, src.begin(), src.end(), rel.template column<To>().begin());
+			if constexpr (sizeof...(Rest) > 0) copy_columns_par<To + 1, Rest...>(rel, policy);
+		}
+
+		template<size_t KeyCol, typename execution_policy, typename... Aggregates>
+		auto do_group_aggregate(execution_policy policy, const Aggregates&... aggregates) const
+		{
+			using key_t = elem_t<KeyCol>;
+			using group_row_t = detail::group_row_t<key_t, tuple_t, Aggregates...>;
+			const column_t<KeyCol>& key = column<KeyCol>();
+			const auto tables = detail::group_tables<key_t, tuple_t>(size(),
+				[&](size_t row) -> const key_t& { return key[row]; },
+				[&](size_t row) { return row_ref(row); },
+				policy, aggregates...);
+			return detail::finish_groups<typename detail::column_relation_of<group_row_t>::type>(tables, aggregates...);
+		}
+
+		template<size_t...I>
+		inline void append_columns(const relation_t& rel, std::index_sequence<I...>)
+		{
+			(std::get<I>(m_columns).insert(std::get<I>(m_columns).end(), std::get<I>(rel.m_columns).begin(), std::get<I>(rel.m_columns).end()), ...);
+		}
+
+		//a new relation with only the given rows, in the given order
+		inline relation_t gather(const std::vector<size_t>& rows) const
+		{
+			relation_t new_relation;
+			std::apply([&](auto&... out) {
+				std::apply([&](const auto&... in) {
+					(gather_column(in, out, rows), ...);
+				}, m_columns);
+			}, new_relation.m_columns);
+			return new_relation;
+		}
+
+		template<typename T>
+		static inline void gather_column(const std::vector<T>& in, std::vector<T>& out, const std::vector<size_t>& rows)
+		{
+			out.reserve(rows.size());
+			for (size_t row : rows)
+			{
+				out.push_back(in[row]);
+			}
+		}
+
+		//reorders every column so that row i becomes the row at order[i]
+		inline void permute(const std::vector<size_t>& order)
+		{
+			std::apply([&](auto&... col) {
+				(permute_column(col, order), ...);
+			}, m_columns);
+		}
+
+		template<typename T>
+		static inline void permute_column(std::vector<T>& col, const std::vector<size_t>& order)
+		{
+			std::vector<T> sorted;
+			sorted.reserve(col.size());
+			for (size_t row : order)
+			{
+				sorted.push_back(std::move(col[row]));
+			}
+			col.swap(sorted);
+		}
+
+		columns_t m_columns{};
+	};
+
+	namespace detail
+	{
+		template<typename... T>
+		struct column_relation_of<std::tuple<T...>>
+		{
+			using type = column_relation<T...>;
+		};
+	};
+};
@@ -0,0 +1,69 @@
+#include "../pch.h"
+#include "database_pool.h"
+
+nl::database_pool::database_pool(const std::filesystem::path& database_file, size_t reader_count, const database_options& options)
+{
+	if (reader_count == 0) reader_count = 1;
+	database_options wal_options = options;
+	wal_options.journal_mode = database_options::journal::wal;
+	wal_options.read_only = false;
+	//the writer is opened first so that the file exists and is switched to WAL before the readers attach
+	m_writer.open(database_file, wal_options);
+	m_writer.set_statement_cache_capacity(statement_cache_capacity);
+
+	database_options read_options = wal_options;
+	read_options.read_only = true;
+	m_readers.reserve(reader_count);
+	m_free_readers.reserve(reader_count);
+	for (size_t i = 0; i < reader_count; i++){
+		nl::database& conn = m_readers.emplace_back(database_file, read_options);
+		conn.set_statement_cache_capacity(statement_cache_capacity);
+		m_free_readers.push_back(i);
+	}
+}
+
+nl::database_pool::connection nl::database_pool::reader()
+{
+	std::unique_lock<std::mutex> lock(m_reader_mutex);
+	m_reader_free.wait(lock, [this]() { return !m_free_readers.empty(); });
+	const size_t index = m_free_readers.back();
+	m_free_readers.pop_back();
+	return connection(*this, &m_readers[index], index);
+}
+
+nl::database_pool::connection nl::database_pool::writer()
+{
+	std::unique_lock<std::mutex> lock(m_writer_mutex);
+	return connection(*this, &m_writer, std::move(lock));
+}
+
+void nl::database_pool::checkin(size_t reader_index)
+{
+	{
+		std::lock_guard<std::mutex> lock(m_reader_mutex);
+		m_free_readers.push_back(reader_index);
+	}
+	m_reader_free.notify_one();
+}
+
+nl::database_pool::connection::connection(database_pool& pool, nl::database* conn, size_t reader_index)
+: m_pool(&pool), m_connection(conn), m_reader_index(reader_index){
+}
+
+nl::database_pool::connection::connection(database_pool& pool, nl::database* conn, std::unique_lock<std::mutex>&& writer_lock)
+: m_pool(&pool), m_connection(conn), m_writer_lock(std::move(writer_lock)){
+}
+
+nl::database_pool::connection::connection(connection&& rhs) noexcept
+: m_pool(rhs.m_pool), m_connection(rhs.m_connection), m_reader_index(rhs.m_reader_index), m_writer_lock(std::move(rhs.m_writer_lock)){
+	rhs.m_connection = nullptr;
+	rhs.m_reader_index = size_t(-1);
+}
+
+nl::database_pool::connection::~connection()
+{
+	//the writer goes back to the pool when m_writer_lock unlocks
+	if (m_connection != nullptr && m_reader_index != size_t(-1)){
+		m_pool->checkin(m_reader_index);
+	}
+}
@@ -0,0 +1,104 @@
+#pragma once
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <filesystem>
+
+#include "Database.h"
+/*
+	a pool of connections to one database file
+	sqlite serializes writers but in WAL mode readers do not block the writer or each other,
+	so the pool keeps one write connection and N read connections opened in WAL mode
+	the read connections are opened SQLITE_OPEN_READONLY with PRAGMA query_only, a write through reader() fails
+	connections are checked out with reader() or writer() and go back to the pool when the handle is destroyed
+	every connection keeps its own statements, the pool turns on the query cache of each connection so
+	a query is prepared once per connection and reused on later checkouts
+*/
+
+namespace nl
+{
+	class database_pool
+	{
+	public:
+		//statements kept per connection by the query cache
+		constexpr static size_t statement_cache_capacity = 128;
+
+		//a checked out connection, only one thread should use it at a time
+		class connection
+		{
+		public:
+			connection(connection&& rhs) noexcept;
+			~connection();
+
+			inline nl::database& operator*() { return *m_connection; }
+			inline nl::database* operator->() { return m_connection; }
+			inline bool is_writer() const { return m_writer_lock.owns_lock(); }
+
+			//prepares the query on this connection the first time it is seen, later calls return the same statement
+			inline nl::database::statement_index prepare_query(const nl::query& query) { return m_connection->prepare_query(query); }
+
+		private:
+			friend class database_pool;
+			connection(database_pool& pool, nl::database* conn, size_t reader_index);
+			connection(database_pool& pool, nl::database* conn, std::unique_lock<std::mutex>&& writer_lock);
+			connection(const connection&) = delete;
+			connection& operator=(const connection&) = delete;
+
+			database_pool* m_pool{ nullptr };
+			nl::database* m_connection{ nullptr };
+			size_t m_reader_index{ size_t(-1) };
+			std::unique_lock<std::mutex> m_writer_lock{};
+		};
+
+		//the journal mode in options is always WAL and read_only is ignored, the other settings are applied to every connection
+		explicit database_pool(const std::filesystem::path& database_file, size_t reader_count = std::thread::hardware_concurrency(),
+			const database_options& options = database_options::performance());
+		~database_pool() = default;
+
+		//blocks until a read connection is free
+		connection reader();
+		//blocks until the write connection is free
+		connection writer();
+
+		inline size_t reader_count() const { return m_readers.size(); }
+		inline const std::string& get_error_msg() const { return m_error_msg; }
+
+		template<typename relation>
+		relation retrive(const nl::query& query)
+		{
+			connection conn = reader();
+			auto index = conn.prepare_query(query);
+			if (index == nl::database::BADSTMT){
+				return relation{};
+			}
+			return conn->retrive<relation>(index);
+		}
+
+		template<typename relation>
+		bool insert(const nl::query& query, const relation& rel)
+		{
+			connection conn = writer();
+			auto index = conn.prepare_query(query);
+			if (index == nl::database::BADSTMT){
+				return false;
+			}
+			return conn->insert(index, rel);
+		}
+
+	private:
+		database_pool(const database_pool&) = delete;
+		database_pool& operator=(const database_pool&) = delete;
+		void checkin(size_t reader_index);
+
+		nl::database m_writer{};
+		//reserved up front and never grown after, so the connections handed out do not move
+		std::vector<nl::database> m_readers{};
+
+		//free read connections as a stack of indices into m_readers
+		std::vector<size_t> m_free_readers{};
+		std::mutex m_reader_mutex{};
+		std::condition_variable m_reader_free{};
+		std::mutex m_writer_mutex{};
+		std::string m_error_msg{};
+	};
+};
@@ -0,0 +1,244 @@
+#pragma once
+#include <vector>
+#include <tuple>
+#include <numeric>
+#include <optional>
+#include <algorithm>
+#include <functional>
+#include <unordered_map>
+#include <type_traits>
+
+#include "hash_join.h"
+#include "aggregate_kernels.h"
+/*
+	group_aggregate<KeyCol>(aggregates...) computes one row per distinct key: the key followed by one value per aggregate
+	no group is ever copied out of the relation, every aggregate keeps a small state per group instead:
+	each task folds its chunk of rows into its own hash table, when the tables are small they are merged one after another,
+	when they are large each is split by the key hash and partition p of every task is merged by a single task,
+	so no phase takes a lock
+	the aggregates are in nl::agg: sum, count, min, max, avg and custom for anything else
+	an aggregate is a type with
+		init<tuple_t>()				the state of a new group
+		step(state, row)			adds a row to the state, row is the relation's tuple, or a tuple of references for a column_relation
+		merge(state, other)			adds the state of the same group from another task
+		result(state)				the value that goes into the output row
+	groups come out in no particular order
+*/
+
+namespace nl
+{
+	namespace agg
+	{
+		template<size_t I>
+		struct sum
+		{
+			template<typename tuple_t>
+			auto init() const { return kernel::sum_t<std::decay_t<std::tuple_element_t<I, tuple_t>>>{}; }
+			template<typename state_t, typename row_t>
+			void step(state_t& state, const row_t& row) const { state += static_cast<state_t>(std::get<I>(row)); }
+			template<typename state_t>
+			void merge(state_t& state, const state_t& other) const { state += other; }
+			template<typename state_t>
+			state_t result(const state_t& state) const { return state; }
+		};
+
+		struct count
+		{
+			template<typename tuple_t>
+			size_t init() const { return 0; }
+			template<typename row_t>
+			void step(size_t& state, const row_t&) const { state++; }
+			void merge(size_t& state, const size_t& other) const { state += other; }
+			size_t result(const size_t& state) const { return state; }
+		};
+
+		template<size_t I, typename order = std::less<>>
+		struct extreme
+		{
+			template<typename tuple_t>
+			auto init() const { return std::optional<std::decay_t<std::tuple_element_t<I, tuple_t>>>{}; }
+			template<typename state_t, typename row_t>
+			void step(state_t& state, const row_t& row) const
+			{
+				const auto& value = std::get<I>(row);
+				if (!state || order{}(value, *state)) state = value;
+			}
+			template<typename state_t>
+			void merge(state_t& state, const state_t& other) const
+			{
+				if (other && (!state || order{}(*other, *state))) state = other;
+			}
+			//a group always has a row, so the state is always set here
+			template<typename state_t>
+			auto result(const state_t& state) const { return *state; }
+		};
+
+		template<size_t I>
+		using min = extreme<I, std::less<>>;
+		template<size_t I>
+		using max = extreme<I, std::greater<>>;
+
+		template<size_t I>
+		struct avg
+		{
+			template<typename tuple_t>
+			std::pair<double, size_t> init() const { return { 0.0, 0 }; }
+			template<typename row_t>
+			void step(std::pair<double, size_t>& state, const row_t& row) const
+			{
+				state.first += static_cast<double>(std::get<I>(row));
+				state.second++;
+			}
+			void merge(std::pair<double, size_t>& state, const std::pair<double, size_t>& other) const
+			{
+				state.first += other.first;
+				state.second += other.second;
+			}
+			double result(const std::pair<double, size_t>& state) const { return state.second == 0 ? 0.0 : state.first / static_cast<double>(state.second); }
+		};
+
+		//an aggregate from functions, step(state&, row), merge(state&, const state&) and finish(const state&) -> value
+		template<typename State, typename Step, typename Merge, typename Finish>
+		struct custom
+		{
+			State initial;
+			Step step_func;
+			Merge merge_func;
+			Finish finish_func;
+
+			template<typename tuple_t>
+			State init() const { return initial; }
+			template<typename row_t>
+			void step(State& state, const row_t& row) const { step_func(state, row); }
+			void merge(State& state, const State& other) const { merge_func(state, other); }
+			auto result(const State& state) const { return finish_func(state); }
+		};
+
+		template<typename State, typename Step, typename Merge, typename Finish>
+		custom<State, Step, Merge, Finish> make_custom(State initial, Step step, Merge merge, Finish finish)
+		{
+			return custom<State, Step, Merge, Finish>{ std::move(initial), std::move(step), std::move(merge), std::move(finish) };
+		}
+	};
+
+	namespace detail
+	{
+		template<typename tuple_t, typename aggregate_t>
+		using aggregate_state_t = decltype(std::declval<const aggregate_t&>().template init<tuple_t>());
+
+		template<typename tuple_t, typename aggregate_t>
+		using aggregate_result_t = std::decay_t<decltype(std::declval<const aggregate_t&>().result(std::declval<const aggregate_state_t<tuple_t, aggregate_t>&>()))>;
+
+		//the output row, the key then one value per aggregate
+		template<typename key_t, typename tuple_t, typename... Aggregates>
+		using group_row_t = std::tuple<key_t, aggregate_result_t<tuple_t, Aggregates>...>;
+
+		template<typename states_t, typename row_t, size_t... I, typename... Aggregates>
+		inline void step_states(states_t& states, const row_t& row, std::index_sequence<I...>, const Aggregates&... aggregates)
+		{
+			(aggregates.step(std::get<I>(states), row), ...);
+		}
+
+		template<typename states_t, size_t... I, typename... Aggregates>
+		inline void merge_states(states_t& states, const states_t& other, std::index_sequence<I...>, const Aggregates&... aggregates)
+		{
+			(aggregates.merge(std::get<I>(states), std::get<I>(other)), ...);
+		}
+
+		//runs rows [0, size) through the aggregates, key_at(i) is the group key of row i, row_at(i) the row passed to step
+		//the result is the merged tables, one per partition or a single one when there were few groups, one row per group when put together
+		template<typename key_t, typename tuple_t, typename KeyAt, typename RowAt, typename execution_policy, typename... Aggregates>
+		auto group_tables(size_t size, KeyAt key_at, RowAt row_at, execution_policy policy, const Aggregates&... aggregates)
+		{
+			static_assert(sizeof...(Aggregates) > 0, "group_aggregate needs at least one aggregate");
+			using states_t = std::tuple<aggregate_state_t<tuple_t, Aggregates>...>;
+			using table_t = std::unordered_map<key_t, states_t>;
+
+			//below this many groups in every chunk one task merges the chunk tables faster than partitions would
+			constexpr size_t min_partitioned_groups = size_t(1) << 12;
+			const join_layout layout = join_layout::make(size);
+			const size_t chunk_size = (size + layout.chunks - 1) / std::max<size_t>(layout.chunks, 1);
+			std::vector<size_t> chunk_ids(layout.chunks);
+			std::iota(chunk_ids.begin(), chunk_ids.end(), size_t(0));
+
+			//tables[chunk] belongs to the task of that chunk only
+			std::vector<table_t> tables(layout.chunks);
+			std::for_each(policy, chunk_ids.begin(), chunk_ids.end(), [&](size_t chunk) {
+				const size_t first = std::min(chunk * chunk_size, size);
+				const size_t last = std::min(first + chunk_size, size);
+				table_t& table = tables[chunk];
+				for (size_t row = first; row < last; row++){
+					const key_t& key = key_at(row);
+					auto it = table.find(key);
+					if (it == table.end()) it = table.emplace(key, states_t(aggregates.template init<tuple_t>()...)).first;
+					step_states(it->second, row_at(row), std::index_sequence_for<Aggregates...>{}, aggregates...);
+				}
+			});
+			if (layout.chunks == 1) return tables;
+
+			auto merge_into = [&](table_t& merged, table_t& other) {
+				for (auto& [key, states] : other){
+					auto [it, inserted] = merged.try_emplace(key, std::move(states));
+					if (!inserted) merge_states(it->second, states, std::index_sequence_for<Aggregates...>{}, aggregates...);
+				}
+				table_t{}.swap(other);
+			};
+
+			size_t largest = 0;
+			for (const auto& table : tables) largest = std::max(largest, table.size());
+			if (largest < min_partitioned_groups){
+				for (size_t chunk = 1; chunk < layout.chunks; chunk++){
+					merge_into(tables[0], tables[chunk]);
+				}
+				tables.resize(1);
+				return tables;
+			}
+
+			//every chunk splits its table by the key hash, parts[chunk * partitions + p] is still written by that chunk's task only
+			const size_t partitions = layout.partitions();
+			std::vector<table_t> parts(layout.chunks * partitions);
+			std::for_each(policy, chunk_ids.begin(), chunk_ids.end(), [&](size_t chunk) {
+				for (auto& [key, states] : tables[chunk]){
+					parts[chunk * partitions + layout.partition_of(mix_hash(std::hash<key_t>{}(key)))].emplace(key, std::move(states));
+				}
+				table_t{}.swap(tables[chunk]);
+			});
+
+			//every partition is merged into the part of chunk 0 by its own task
+			std::vector<size_t> partition_ids(partitions);
+			std::iota(partition_ids.begin(), partition_ids.end(), size_t(0));
+			std::for_each(policy, partition_ids.begin(), partition_ids.end(), [&](size_t p) {
+				for (size_t chunk = 1; chunk < layout.chunks; chunk++){
+					merge_into(parts[p], parts[chunk * partitions + p]);
+				}
+			});
+			parts.resize(partitions);
+			return parts;
+		}
+
+		template<typename row_t, typename key_t, typename states_t, size_t... I, typename... Aggregates>
+		inline row_t finish_states(const key_t& key, const states_t& states, std::index_sequence<I...>, const Aggregates&... aggregates)
+		{
+			return row_t(key, aggregates.result(std::get<I>(states))...);
+		}
+
+		//puts the merged tables into out_t, one row per group
+		template<typename out_t, typename table_t, typename... Aggregates>
+		out_t finish_groups(const std::vector<table_t>& tables, const Aggregates&... aggregates)
+		{
+			using row_t = typename out_t::tuple_t;
+			out_t out;
+			if constexpr (can_reserve<out_t>::value){
+				size_t groups = 0;
+				for (const auto& table : tables) groups += table.size();
+				out.reserve(groups);
+			}
+			for (const auto& table : tables){
+				for (const auto& [key, states] : table){
+					out.push_back(finish_states<row_t>(key, states, std::index_sequence_for<Aggregates...>{}, aggregates...));
+				}
+			}
+			return out;
+		}
+	};
+};
@@ -0,0 +1,228 @@
+#pragma once
+#include <vector>
+#include <numeric>
+#include <algorithm>
+#include <iterator>
+#include <thread>
+#include <cstdint>
+#include <functional>
+#include <type_traits>
+
+#include "tuple_loop.h"
+/*
+	partitioned hash join used by the *_par joins
+	both sides are hashed once and scattered into 2^n partitions on the top bits of the hash, every chunk of rows is
+	counted and scattered by its own task, so the partitioning needs no locks
+	each partition is then joined by one task: an open addressing table over the right rows of that partition,
+	probed with the left rows of the same partition, matches go into that partition's own output buffer
+	the tables stay small enough for the cache and no two tasks write to the same memory until the buffers are concatenated
+	duplicate keys on both sides are kept, every pair of rows with equal keys is joined
+*/
+
+namespace nl
+{
+	namespace detail
+	{
+		//rows of a relation by position, random access relations are indexed in place, others are collected into iterators first
+		template<typename rel_t>
+		class row_access
+		{
+		public:
+			using iterator = typename rel_t::const_iterator;
+			constexpr static bool random_access = std::is_base_of_v<std::random_access_iterator_tag,
+				typename std::iterator_traits<iterator>::iterator_category>;
+
+			explicit row_access(const rel_t& rel) : m_first(rel.begin()), m_size(rel.size())
+			{
+				if constexpr (!random_access){
+					m_rows.reserve(m_size);
+					for (auto it = rel.begin(); it != rel.end(); ++it){
+						m_rows.push_back(it);
+					}
+				}
+			}
+
+			inline size_t size() const { return m_size; }
+
+			inline decltype(auto) operator[](size_t row) const
+			{
+				if constexpr (random_access) return *(m_first + row);
+				else return *m_rows[row];
+			}
+
+		private:
+			iterator m_first;
+			size_t m_size{ 0 };
+			std::vector<iterator> m_rows;
+		};
+
+		//std::hash is the identity for integers, the bits are mixed so that the top bits can pick the partition
+		inline std::uint64_t mix_hash(std::uint64_t h) noexcept
+		{
+			h ^= h >> 33;
+			h *= 0xff51afd7ed558ccdULL;
+			h ^= h >> 33;
+			h *= 0xc4ceb9fe1a85ec53ULL;
+			h ^= h >> 33;
+			return h;
+		}
+
+		struct join_entry
+		{
+			std::uint64_t hash;
+			size_t row;
+		};
+
+		//the rows of one side scattered by partition, partition p is entries[offsets[p], offsets[p + 1])
+		struct partitioned_rows
+		{
+			std::vector<join_entry> entries;
+			std::vector<size_t> offsets;
+		};
+
+		struct join_layout
+		{
+			size_t chunks{ 1 };
+			unsigned partition_bits{ 0 };
+
+			inline size_t partitions() const { return size_t(1) << partition_bits; }
+			inline size_t partition_of(std::uint64_t hash) const { return partition_bits == 0 ? 0 : static_cast<size_t>(hash >> (64 - partition_bits)); }
+
+			//one chunk per core, about eight partitions per core so a slow partition does not hold up the join
+			static join_layout make(size_t rows)
+			{
+				constexpr size_t min_parallel_rows = size_t(1) << 14;
+				constexpr unsigned max_partition_bits = 10;
+				join_layout layout;
+				if (rows < min_parallel_rows) return layout;
+				const size_t threads = std::max<size_t>(std::thread::hardware_concurrency(), 1);
+				layout.chunks = threads;
+				while (layout.partition_bits < max_partition_bits && layout.partitions() < threads * 8){
+					layout.partition_bits++;
+				}
+				return layout;
+			}
+		};
+
+		//hashes rows [0, size) with key_at and scatters them by partition, the order of rows inside a partition is kept
+		template<typename key_t, typename KeyAt, typename execution_policy>
+		partitioned_rows partition_rows(size_t size, KeyAt key_at, const join_layout& layout, execution_policy policy)
+		{
+			const size_t partitions = layout.partitions();
+			const size_t chunk_size = (size + layout.chunks - 1) / layout.chunks;
+			std::vector<size_t> chunk_ids(layout.chunks);
+			std::iota(chunk_ids.begin(), chunk_ids.end(), size_t(0));
+
+			std::vector<std::uint64_t> hashes(size);
+			std::vector<size_t> counts(layout.chunks * partitions, 0);
+			std::for_each(policy, chunk_ids.begin(), chunk_ids.end(), [&](size_t chunk) {
+				const size_t first = std::min(chunk * chunk_size, size);
+				const size_t last = std::min(first + chunk_size, size);
+				size_t* count = &counts[chunk * partitions];
+				for (size_t row = first; row < last; row++){
+					hashes[row] = mix_hash(std::hash<key_t>{}(static_cast<const key_t&>(key_at(row))));
+					count[layout.partition_of(hashes[row])]++;
+				}
+			});
+
+			//partition major, so each partition is one contiguous range and each chunk writes its own part of it
+			partitioned_rows result;
+			result.offsets.resize(partitions + 1, 0);
+			std::vector<size_t> cursor(layout.chunks * partitions, 0);
+			size_t offset = 0;
+			for (size_t p = 0; p < partitions; p++){
+				result.offsets[p] = offset;
+				for (size_t chunk = 0; chunk < layout.chunks; chunk++){
+					cursor[chunk * partitions + p] = offset;
+					offset += counts[chunk * partitions + p];
+				}
+			}
+			result.offsets[partitions] = offset;
+
+			result.entries.resize(size);
+			std::for_each(policy, chunk_ids.begin(), chunk_ids.end(), [&](size_t chunk) {
+				const size_t first = std::min(chunk * chunk_size, size);
+				const size_t last = std::min(first + chunk_size, size);
+				size_t* next = &cursor[chunk * partitions];
+				for (size_t row = first; row < last; row++){
+					result.entries[next[layout.partition_of(hashes[row])]++] = join_entry{ hashes[row], row };
+				}
+			});
+			return result;
+		}
+
+		//joins left rows [0, left_size) with right rows [0, right_size) on left_key(i) == right_key(j)
+		//make_row(i, j) makes the output row, the result is one buffer per partition, see append_partitions
+		template<typename out_t, typename key_t, typename LeftKey, typename RightKey, typename MakeRow, typename execution_policy>
+		std::vector<std::vector<out_t>> hash_join(size_t left_size, LeftKey left_key, size_t right_size, RightKey right_key,
+			MakeRow make_row, execution_policy policy)
+		{
+			const join_layout layout = join_layout::make(left_size + right_size);
+			const partitioned_rows left = partition_rows<key_t>(left_size, left_key, layout, policy);
+			const partitioned_rows right = partition_rows<key_t>(right_size, right_key, layout, policy);
+
+			std::vector<std::vector<out_t>> output(layout.partitions());
+			std::vector<size_t> partition_ids(layout.partitions());
+			std::iota(partition_ids.begin(), partition_ids.end(), size_t(0));
+			std::for_each(policy, partition_ids.begin(), partition_ids.end(), [&](size_t p) {
+				const join_entry* build = right.entries.data() + right.offsets[p];
+				const size_t build_size = right.offsets[p + 1] - right.offsets[p];
+				const join_entry* probe = left.entries.data() + left.offsets[p];
+				const size_t probe_size = left.offsets[p + 1] - left.offsets[p];
+				if (build_size == 0 || probe_size == 0) return;
+
+				//linear probing at most half full, equal keys sit in the same run in the order they were inserted
+				constexpr size_t empty = size_t(-1);
+				size_t capacity = 16;
+				while (capacity < build_size * 2) capacity <<= 1;
+				const size_t mask = capacity - 1;
+				std::vector<size_t> slots(capacity, empty);
+				for (size_t b = 0; b < build_size; b++){
+					size_t pos = static_cast<size_t>(build[b].hash) & mask;
+					while (slots[pos] != empty) pos = (pos + 1) & mask;
+					slots[pos] = b;
+				}
+
+				//the match count is not known up front, a key can match no rows or many, so the buffer grows as it goes
+				std::vector<out_t>& out = output[p];
+				for (size_t l = 0; l < probe_size; l++){
+					const join_entry& entry = probe[l];
+					for (size_t pos = static_cast<size_t>(entry.hash) & mask; slots[pos] != empty; pos = (pos + 1) & mask){
+						const join_entry& match = build[slots[pos]];
+						if (match.hash == entry.hash && right_key(match.row) == left_key(entry.row)){
+							out.push_back(make_row(entry.row, match.row));
+						}
+					}
+				}
+			});
+			return output;
+		}
+
+		//concatenates the partition buffers into rel, vectors are sized once and filled in parallel, other containers are appended to
+		template<typename relation_t, typename out_t, typename execution_policy>
+		void append_partitions(relation_t& rel, std::vector<std::vector<out_t>>& parts, execution_policy policy)
+		{
+			std::vector<size_t> offsets(parts.size() + 1, 0);
+			for (size_t p = 0; p < parts.size(); p++){
+				offsets[p + 1] = offsets[p] + parts[p].size();
+			}
+			if constexpr (row_access<relation_t>::random_access && can_reserve<relation_t>::value && is_linear_relation<relation_t>::value){
+				const size_t start = rel.size();
+				rel.resize(start + offsets.back());
+				std::vector<size_t> partition_ids(parts.size());
+				std::iota(partition_ids.begin(), partition_ids.end(), size_t(0));
+				std::for_each(policy, partition_ids.begin(), partition_ids.end(), [&](size_t p) {
+					std::move(parts[p].begin(), parts[p].end(), std::next(rel.begin(), start + offsets[p]));
+				});
+			}
+			else{
+				if constexpr (can_reserve<relation_t>::value) rel.reserve(rel.size() + offsets.back());
+				for (auto& part : parts){
+					for (auto& row : part){
+						rel.push_back(std::move(row));
+					}
+				}
+			}
+		}
+	};
+};
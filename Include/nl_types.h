@@ -1,6 +1,7 @@
 #pragma once
 #include <vector>
 #include <variant>
+#include <algorithm>
 #include "tuple_t_operations.h"
 namespace nl
 {
@@ -18,6 +19,7 @@ namespace nl
 
 	struct linear_relation_tag {};
 	struct map_relation_tag {};
+	struct columnar_relation_tag {};
 
 
 	template<typename T>
@@ -33,6 +35,10 @@ namespace nl
 	struct set_relation_tag;
 	struct hash_relation_tag;
 	struct map_relation_tag;
+	struct columnar_relation_tag;
+
+	template<typename... val>
+	class column_relation;
 
 
 	template<typename...T>
@@ -47,6 +53,41 @@ namespace nl
 
 	using blob_t = std::vector<std::uint8_t>;
 
+	//binds a blob of size zero bytes, it reserves the space so the blob can be filled in chunks through database::blob_stream
+	struct zeroblob
+	{
+		std::uint64_t size{ 0 };
+	};
+
+	//a non owning view of a blob, the std::span<const std::uint8_t> interface without needing c++20
+	//when retrived from a database it points into sqlite's buffer and is only valid until the statement is stepped again
+	class blob_view
+	{
+	public:
+		using value_type = std::uint8_t;
+		using const_iterator = const std::uint8_t*;
+
+		constexpr blob_view() noexcept = default;
+		constexpr blob_view(const std::uint8_t* data, size_t size) noexcept : m_data(data), m_size(size) {}
+		blob_view(const blob_t& blob) noexcept : m_data(blob.data()), m_size(blob.size()) {}
+
+		constexpr const std::uint8_t* data() const noexcept { return m_data; }
+		constexpr size_t size() const noexcept { return m_size; }
+		constexpr bool empty() const noexcept { return (m_size == 0); }
+		constexpr const_iterator begin() const noexcept { return m_data; }
+		constexpr const_iterator end() const noexcept { return m_data + m_size; }
+		constexpr std::uint8_t operator[](size_t i) const noexcept { return m_data[i]; }
+
+		inline blob_t to_blob() const { return blob_t(begin(), end()); }
+		friend inline bool operator==(const blob_view& lhs, const blob_view& rhs) { return std::equal(lhs.begin(), lhs.end(), rhs.begin(), rhs.end()); }
+		friend inline bool operator!=(const blob_view& lhs, const blob_view& rhs) { return !(lhs == rhs); }
+		friend inline bool operator<(const blob_view& lhs, const blob_view& rhs) { return std::lexicographical_compare(lhs.begin(), lhs.end(), rhs.begin(), rhs.end()); }
+
+	private:
+		const std::uint8_t* m_data{ nullptr };
+		size_t m_size{ 0 };
+	};
+
 	template<typename tuple> struct variant_no_duplicate;
 
 	template<typename ... val>
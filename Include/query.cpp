@@ -170,12 +170,97 @@ query& nl::query::begin_immediate()
 	return (*this);
 }
 
+query& nl::query::begin_exclusive()
+{
+	mQuery << "BEGIN EXCLUSIVE ";
+	return (*this);
+}
+
 query& nl::query::roll_back()
 {
 	mQuery << "ROLLBACK ";
 	return (*this);
 }
 
+query& query::savepoint(const std::string_view& name)
+{
+	mQuery << fmt::format("SAVEPOINT {} ", name);
+	return (*this);
+}
+
+query& query::release(const std::string_view& name)
+{
+	mQuery << fmt::format("RELEASE {} ", name);
+	return (*this);
+}
+
+query& query::roll_back_to(const std::string_view& name)
+{
+	mQuery << fmt::format("ROLLBACK TO {} ", name);
+	return (*this);
+}
+
+namespace {
+	//a, b, c
+	std::string join_names(const std::vector<std::string_view>& names)
+	{
+		std::string joined;
+		for (size_t i = 0; i < names.size(); i++)
+		{
+			if (i != 0) joined += ", ";
+			joined += names[i];
+		}
+		return joined;
+	}
+
+	//a = excluded.a, b = excluded.b
+	std::string join_excluded(const std::vector<std::string_view>& names)
+	{
+		std::string joined;
+		for (size_t i = 0; i < names.size(); i++)
+		{
+			if (i != 0) joined += ", ";
+			joined += fmt::format("{0} = excluded.{0}", names[i]);
+		}
+		return joined;
+	}
+}
+
+query& query::columns(const std::vector<std::string_view>& cols)
+{
+	mQuery << fmt::format("({}) ", join_names(cols));
+	return (*this);
+}
+
+query& query::placeholders(size_t count)
+{
+	std::string ft = "VALUES (";
+	for (size_t i = 0; i < count; i++)
+	{
+		ft += (i == 0) ? "?" : ", ?";
+	}
+	mQuery << ft << ") ";
+	return (*this);
+}
+
+query& query::on_conflict(const std::vector<std::string_view>& cols)
+{
+	mQuery << fmt::format("ON CONFLICT ({}) ", join_names(cols));
+	return (*this);
+}
+
+query& query::do_update_excluded(const std::vector<std::string_view>& cols)
+{
+	mQuery << fmt::format("DO UPDATE SET {} ", join_excluded(cols));
+	return (*this);
+}
+
+query& query::do_nothing()
+{
+	mQuery << "DO NOTHING ";
+	return (*this);
+}
+
 query& query::end()
 {
 	mQuery << "END ";
@@ -243,7 +243,18 @@ namespace nl
 		query& end();
 		query& begin();
 		query& begin_immediate();
+		query& begin_exclusive();
 		query& roll_back();
+		query& savepoint(const std::string_view& name);
+		query& release(const std::string_view& name);
+		query& roll_back_to(const std::string_view& name);
+
+		//for INSERT INTO table (a, b) VALUES (?, ?) ON CONFLICT (a) DO UPDATE SET b = excluded.b
+		query& columns(const std::vector<std::string_view>& cols);
+		query& placeholders(size_t count);
+		query& on_conflict(const std::vector<std::string_view>& cols);
+		query& do_update_excluded(const std::vector<std::string_view>& cols);
+		query& do_nothing();
 
 
 		//appends a ";" at the end
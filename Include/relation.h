@@ -2,6 +2,9 @@
 #include "../pch.h"
 #include "tuple_loop.h"
 #include "relation_buffer.h"
+#include "aggregate_kernels.h"
+#include "hash_join.h"
+#include "group_aggregate.h"
 	/////////////////////////////////////////////////////////////
 	// relation represents a frame of data from the database
 	// reads and writes to the database a done via relations
@@ -118,6 +121,32 @@ namespace nl {
 			return 0.0;
 		}
 
+		//the values are spread over the rows so these run the scalar kernels, column_relation runs them vectorized
+		template<size_t I>
+		inline auto sum() const
+		{
+			return kernel::sum(container_t::begin(), container_t::end(), [](const tuple_t& tuple) -> const elem_t<I>& { return std::get<I>(tuple); });
+		}
+
+		//smallest and largest value in column I, a pair of default values when the relation is empty
+		template<size_t I>
+		inline std::pair<elem_t<I>, elem_t<I>> min_max() const
+		{
+			return kernel::min_max(container_t::begin(), container_t::end(), [](const tuple_t& tuple) -> const elem_t<I>& { return std::get<I>(tuple); });
+		}
+
+		template<size_t I, typename Pred>
+		inline size_t count_if(Pred pred) const
+		{
+			return kernel::count_if(container_t::begin(), container_t::end(), [](const tuple_t& tuple) -> const elem_t<I>& { return std::get<I>(tuple); }, pred);
+		}
+
+		template<size_t I>
+		inline double variance() const
+		{
+			return kernel::variance(container_t::begin(), container_t::end(), [](const tuple_t& tuple) -> const elem_t<I>& { return std::get<I>(tuple); });
+		}
+
 		inline typename container_t::iterator add(const val& ... args)
 		{
 			static_assert(std::tuple_size_v<tuple_t> == sizeof...(args), "Incomplete argument in add");
@@ -753,22 +782,16 @@ namespace nl {
 				}, policy);
 		}
 
-		template<size_t...I>
-		auto select_par()
+		//row i of the result is made from row i of this relation, so every row is written to its own presized slot
+		template<size_t...I, typename execution_policy = std::execution::parallel_policy>
+		auto select_par(execution_policy policy = std::execution::par) const
 		{
 			using T = std::tuple<std::tuple_element_t<I, tuple_t>...>;
 			relation<container<T, alloc_t<T>>> new_relation(container_t::size());
-			
-			//atomic_counter ?? might be better
-			std::mutex m;
-			volatile size_t x{ 0 };
-			std::for_each(std::execution::par, container_t::begin(), container_t::end(), [&](const tuple_t& value) {
-				std::unique_lock<std::mutex> lock(m);
-				thread_local size_t index = x++;
-				lock.unlock();
-				new_relation[index] = std::make_tuple(std::get<I>(value)...);
+			std::transform(policy, container_t::begin(), container_t::end(), new_relation.begin(), [](const tuple_t& row_) -> T {
+				return T(std::get<I>(row_)...);
 			});
-			return std::move(new_relation);
+			return new_relation;
 		}
 		
 
@@ -781,30 +804,26 @@ namespace nl {
 			container_t::erase(it, container_t::end());
 		}
 
+		//partitioned hash join, see hash_join.h, no locks are taken and it scales with the cores
+		//every pair of rows with equal keys is in the result, the rows come out grouped by hash partition, not in the order of this relation
 		template<size_t I1, size_t I2, typename rel_t, typename execution_policy = std::execution::parallel_policy >
-		auto join_on_par(const rel_t& rel, execution_policy policy = std::execution::par)
+		auto join_on_par(const rel_t& rel, execution_policy policy = std::execution::par) const
 		{
 			static_assert(std::is_same_v<typename std::tuple_element_t<I1, tuple_t>, typename std::tuple_element_t<I2, typename rel_t::tuple_t>>
 				|| std::is_convertible_v<elem_t<I1>, typename rel_t::template elem_t<I2> >, "Cannot join on column that are not same type or the types are not convertible");
-			using type = typename detail::join_tuple_type<tuple_t, typename relation_t::tuple_t>::type;
-			
-			relation<container<type, alloc_t<type>>> new_relation;
-			std::unordered_map<std::tuple_element_t<I2, typename relation_t::tuple_t>, typename relation_t::tuple_t*> find_map;
-
-			std::mutex m1, m2;
-			std::for_each(policy, rel.begin(), rel.end(), [&](const typename rel_t::tuple_t& value) {
-				std::lock_guard<std::mutex> lock(m1);
-				find_map.insert(std::make_pair(std::get<I2>(value), &value));
-			});
+			using type = typename detail::join_tuple_type<tuple_t, typename rel_t::tuple_t>::type;
+			using key_t = std::tuple_element_t<I2, typename rel_t::tuple_t>;
 
-			std::for_each(policy, container_t::begin(), container_t::end(), [&](const tuple_t& value) {
-				std::lock_guard<std::mutex> lock(m2);
-				auto find_iter = find_map.find(std::get<I1>(value));
-				if (find_iter != find_map.end()){
-					new_relation.push_back(std::forward<type>(std::tuple_cat(value, *(find_iter->second))));
-				}
-			});
-			return std::move(new_relation);
+			relation<container<type, alloc_t<type>>> new_relation;
+			const detail::row_access<relation_t> left(*this);
+			const detail::row_access<rel_t> right(rel);
+			auto parts = detail::hash_join<type, key_t>(
+				left.size(), [&](size_t row) -> decltype(auto) { return std::get<I1>(left[row]); },
+				right.size(), [&](size_t row) -> decltype(auto) { return std::get<I2>(right[row]); },
+				[&](size_t l, size_t r) { return type(std::tuple_cat(left[l], right[r])); },
+				policy);
+			detail::append_partitions(new_relation, parts, policy);
+			return new_relation;
 		}
 
 		template<size_t col, typename execution_policy = std::execution::parallel_policy >
@@ -814,19 +833,61 @@ namespace nl {
 				return(value == std::get<col>(tuple));
 			});
 		}
+		//each task groups its own chunk of rows into its own map, the maps are then spliced together, no lock is taken per row
 		template<size_t I, typename execution_policy = std::execution::parallel_policy>
-		auto map_group_by_par(execution_policy policy = std::execution::par) {
-			std::unordered_map<elem_t<I>, relation_t> group_map;
-			std::mutex m;
-			std::for_each(policy, container_t::begin(), container_t::end(), [&](const tuple_t& value) {
-				std::lock_guard<std::mutex> lock(m);
-				group_map[std::get<I>(value)].push_back(value);
+		auto map_group_by_par(execution_policy policy = std::execution::par) const {
+			using map_t = std::unordered_map<elem_t<I>, relation_t>;
+			const detail::row_access<relation_t> rows(*this);
+			const size_t size = rows.size();
+			const size_t chunks = std::max<size_t>(std::min<size_t>(std::thread::hardware_concurrency(), size), 1);
+			const size_t chunk_size = (size + chunks - 1) / chunks;
+			std::vector<map_t> chunk_maps(chunks);
+			std::vector<size_t> chunk_ids(chunks);
+			std::iota(chunk_ids.begin(), chunk_ids.end(), size_t(0));
+			std::for_each(policy, chunk_ids.begin(), chunk_ids.end(), [&](size_t chunk) {
+				const size_t last = std::min((chunk + 1) * chunk_size, size);
+				for (size_t row = chunk * chunk_size; row < last; row++){
+					const tuple_t& value = rows[row];
+					chunk_maps[chunk][std::get<I>(value)].push_back(value);
+				}
 			});
+
+			map_t group_map = std::move(chunk_maps[0]);
+			for (size_t chunk = 1; chunk < chunks; chunk++){
+				for (auto& [key, group] : chunk_maps[chunk]){
+					relation_t& into = group_map[key];
+					if (into.empty()) into.swap(group);
+					else std::move(group.begin(), group.end(), std::back_inserter(into));
+				}
+			}
 			return group_map;
 		}
 
+		//one row per distinct value of column KeyCol, the key then one value per aggregate, see group_aggregate.h
+		//group_aggregate<0>(nl::agg::sum<2>{}, nl::agg::count{}), an execution policy can be passed first, par by default
+		template<size_t KeyCol, typename First, typename... Rest>
+		auto group_aggregate(const First& first, const Rest&... rest) const
+		{
+			if constexpr (std::is_execution_policy_v<First>) return do_group_aggregate<KeyCol>(first, rest...);
+			else return do_group_aggregate<KeyCol>(std::execution::par, first, rest...);
+		}
+
 	protected:
 		static row_t default_row;
+
+		template<size_t KeyCol, typename execution_policy, typename... Aggregates>
+		auto do_group_aggregate(execution_policy policy, const Aggregates&... aggregates) const
+		{
+			using key_t = elem_t<KeyCol>;
+			using group_row_t = detail::group_row_t<key_t, tuple_t, Aggregates...>;
+			const detail::row_access<relation_t> rows(*this);
+			const auto tables = detail::group_tables<key_t, tuple_t>(rows.size(),
+				[&](size_t row) -> const key_t& { return std::get<KeyCol>(rows[row]); },
+				[&](size_t row) -> const tuple_t& { return rows[row]; },
+				policy, aggregates...);
+			return detail::finish_groups<relation<container<group_row_t, alloc_t<group_row_t>>>>(tables, aggregates...);
+		}
+
 		inline const tuple_t& tuple_at(size_t row) const{
 			return *(std::next(container_t::begin(), row));
 		}
@@ -169,11 +169,17 @@ namespace nl
 		if constexpr (detail::has_base_relation<relation_t>::value || detail::is_relation_v<relation_t>)
 		{
 				assert(rel.empty() && "Relation should be empty, overwrite of data already in the buffer");
-				std::insert_iterator<typename relation_t::container_t> insert(rel, rel.begin());
-				while (!buffer.read_head_at_end()){
-					std::back_insert_iterator<typename relation_t::container_t> back_insert(rel);
-					back_insert = std::forward<typename relation_t::tuple_t>(detail::loop<relation_t::column_count -1>::template do_buffer_read<relation_t, relation_buffer>(buffer));
+				if constexpr (detail::is_columnar_relation<relation_t>::value){
+					while (!buffer.read_head_at_end()){
+						rel.push_back(detail::loop<relation_t::column_count -1>::template do_buffer_read<relation_t, relation_buffer>(buffer));
+					}
+				}
+				else{
+					while (!buffer.read_head_at_end()){
+						std::back_insert_iterator<typename relation_t::container_t> back_insert(rel);
+						back_insert = std::forward<typename relation_t::tuple_t>(detail::loop<relation_t::column_count -1>::template do_buffer_read<relation_t, relation_buffer>(buffer));
 
+					}
 				}
 		}
 	}
@@ -183,11 +189,19 @@ namespace nl
 		if constexpr (detail::has_base_relation<relation_t>::value || detail::is_relation_v<relation_t>)
 		{
 			assert(!rel.empty() && "Cannot write buffer from empty relation");
-			for (auto& elem : rel)
-			{
-				auto& _elem = const_cast<std::remove_const_t<typename relation_t::container_t::value_type>&>(elem);
-				detail::loop<relation_t::column_count -1>::template do_buffer_write<relation_t, relation_buffer>(buffer, _elem);
+			if constexpr (detail::is_columnar_relation<relation_t>::value){
+				for (size_t i = 0; i < rel.size(); i++){
+					auto elem = rel.tuple_at(i);
+					detail::loop<relation_t::column_count -1>::template do_buffer_write<relation_t, relation_buffer>(buffer, elem);
+				}
+			}
+			else{
+				for (auto& elem : rel)
+				{
+					auto& _elem = const_cast<std::remove_const_t<typename relation_t::container_t::value_type>&>(elem);
+					detail::loop<relation_t::column_count -1>::template do_buffer_write<relation_t, relation_buffer>(buffer, _elem);
 
+				}
 			}
 		}
 	}
@@ -0,0 +1,275 @@
+#pragma once
+#include <cmath>
+#include <algorithm>
+#include <string>
+#include <utility>
+#include <SQLite/sqlite3.h>
+#include <fmt/format.h>
+
+#include "tuple_loop.h"
+/*
+	a read only sqlite virtual table over a relation that lives in memory
+	sql can select from and join against the relation without it being copied into a table first
+	the table is eponymous only, it exists under its module name as soon as the module is registered, no CREATE VIRTUAL TABLE is needed
+	columns are named from the relation's col_names (BEGIN_COL_NAME) when it has them, col0, col1... otherwise
+	if the relation is sorted on a column, equality and ORDER BY on that column use a binary search instead of a scan
+	the relation is not copied, it must outlive the connection and must not be changed while a statement is reading from it
+*/
+
+namespace nl
+{
+	template<typename relation_t>
+	class relation_vtab
+	{
+	public:
+		using tuple_t = typename relation_t::tuple_t;
+		using iterator = typename relation_t::const_iterator;
+		constexpr static size_t column_count = std::tuple_size_v<tuple_t>;
+		constexpr static size_t no_sorted_column = size_t(-1);
+
+		//what the module is registered with, sqlite owns it and deletes it through destroy_registration
+		struct registration
+		{
+			const relation_t* rel{ nullptr };
+			size_t sorted_column{ no_sorted_column };
+		};
+
+		static const sqlite3_module* module()
+		{
+			static const sqlite3_module mod = make_module();
+			return &mod;
+		}
+
+		static void destroy_registration(void* data)
+		{
+			delete static_cast<registration*>(data);
+		}
+
+		//CREATE TABLE x(...) declaring the relation's columns with their sqlite types
+		static std::string schema()
+		{
+			std::string columns;
+			append_columns(columns, std::make_index_sequence<column_count>{});
+			return fmt::format("CREATE TABLE x({});", columns);
+		}
+
+	private:
+		struct table : sqlite3_vtab
+		{
+			registration reg{};
+		};
+
+		struct cursor : sqlite3_vtab_cursor
+		{
+			iterator current{};
+			iterator last{};
+			sqlite3_int64 rowid{ 0 };
+		};
+
+		template<typename T, typename = void>
+		struct has_col_names : std::false_type {};
+
+		template<typename T>
+		struct has_col_names<T, std::void_t<decltype(T::col_names)>> : std::true_type {};
+
+		template<typename T>
+		constexpr static const char* column_type()
+		{
+			using arg_t = std::decay_t<T>;
+			if constexpr (std::is_floating_point_v<arg_t>) return "REAL";
+			else if constexpr (std::is_same_v<arg_t, std::string> || std::is_same_v<arg_t, std::string_view>) return "TEXT";
+			else if constexpr (std::is_same_v<arg_t, blob_t> || std::is_same_v<arg_t, blob_view> || std::is_same_v<arg_t, uuid>) return "BLOB";
+			else return "INTEGER";
+		}
+
+		template<size_t... I>
+		static void append_columns(std::string& columns, std::index_sequence<I...>)
+		{
+			((columns += fmt::format("{}{} {}", (I == 0 ? "" : ", "), column_name<I>(), column_type<std::tuple_element_t<I, tuple_t>>())), ...);
+		}
+
+		template<size_t I>
+		static std::string column_name()
+		{
+			if constexpr (has_col_names<relation_t>::value)
+			{
+				return std::string(relation_t::col_names[I]);
+			}
+			else
+			{
+				return fmt::format("col{:d}", I);
+			}
+		}
+
+		//sets the result to column col of the current row, the column is only known at run time so it goes through a table of getters
+		//a column_relation is read straight from its column, dereferencing its iterator would build a tuple of the whole row
+		template<size_t... I>
+		static void column_result(sqlite3_context* context, const relation_t& rel, const cursor& cur, int col, std::index_sequence<I...>)
+		{
+			using getter_t = void(*)(sqlite3_context*, const relation_t&, const cursor&);
+			static constexpr getter_t getters[] = { [](sqlite3_context* c, const relation_t& r, const cursor& cu) {
+				if constexpr (nl::detail::is_columnar_relation<relation_t>::value){
+					nl::detail::handle_result(c, r.template column<I>()[static_cast<size_t>(cu.rowid)]);
+				}
+				else{
+					(void)r;
+					nl::detail::handle_result(c, std::get<I>(*cu.current));
+				}
+			}... };
+			getters[col](context, rel, cur);
+		}
+
+		//the rows whose sorted column equals value, a column_relation is searched on the sorted column alone
+		template<size_t... I>
+		static std::pair<iterator, iterator> equal_rows(const relation_t& rel, size_t col, sqlite3_value* value, std::index_sequence<I...>)
+		{
+			using finder_t = std::pair<iterator, iterator>(*)(const relation_t&, sqlite3_value*);
+			static constexpr finder_t finders[] = { [](const relation_t& r, sqlite3_value* v) {
+				using elem_t = std::decay_t<std::tuple_element_t<I, tuple_t>>;
+				const elem_t key = nl::detail::handle_value<elem_t>(v);
+				if constexpr (nl::detail::is_columnar_relation<relation_t>::value){
+					const auto& sorted = r.template column<I>();
+					const auto [first, last] = std::equal_range(sorted.begin(), sorted.end(), key);
+					return std::make_pair(r.begin() + (first - sorted.begin()), r.begin() + (last - sorted.begin()));
+				}
+				else{
+					return std::equal_range(r.begin(), r.end(), key, nl::detail::comp_tuple_with_value<I, tuple_t, elem_t>{});
+				}
+			}... };
+			return finders[col](rel, value);
+		}
+
+		static int connect(sqlite3* db, void* aux, int, const char* const*, sqlite3_vtab** vtab, char**)
+		{
+			const int ret = sqlite3_declare_vtab(db, schema().c_str());
+			if (ret != SQLITE_OK) return ret;
+			table* tab = new table{};
+			tab->reg = *static_cast<registration*>(aux);
+			*vtab = tab;
+			return SQLITE_OK;
+		}
+
+		static int disconnect(sqlite3_vtab* vtab)
+		{
+			delete static_cast<table*>(vtab);
+			return SQLITE_OK;
+		}
+
+		static int best_index(sqlite3_vtab* vtab, sqlite3_index_info* info)
+		{
+			const registration& reg = static_cast<table*>(vtab)->reg;
+			const double rows = static_cast<double>(std::max<size_t>(reg.rel->size(), 1));
+			info->idxNum = 0;
+			info->estimatedCost = rows;
+			info->estimatedRows = static_cast<sqlite3_int64>(rows);
+			if (reg.sorted_column == no_sorted_column) return SQLITE_OK;
+
+			for (int i = 0; i < info->nConstraint; i++){
+				const auto& constraint = info->aConstraint[i];
+				if (constraint.usable && constraint.op == SQLITE_INDEX_CONSTRAINT_EQ && constraint.iColumn == static_cast<int>(reg.sorted_column)){
+					//sqlite still checks the constraint on the rows returned, values of a different type are compared the sql way
+					info->aConstraintUsage[i].argvIndex = 1;
+					info->aConstraintUsage[i].omit = 0;
+					info->idxNum = 1;
+					info->estimatedCost = std::log2(rows) + 1.0;
+					info->estimatedRows = 1;
+					break;
+				}
+			}
+			//rows come out in the order of the sorted column, an ORDER BY on it alone needs no sort
+			if (info->nOrderBy == 1 && info->aOrderBy[0].iColumn == static_cast<int>(reg.sorted_column) && !info->aOrderBy[0].desc){
+				info->orderByConsumed = 1;
+			}
+			return SQLITE_OK;
+		}
+
+		static int open(sqlite3_vtab*, sqlite3_vtab_cursor** cur)
+		{
+			*cur = new cursor{};
+			return SQLITE_OK;
+		}
+
+		static int close(sqlite3_vtab_cursor* cur)
+		{
+			delete static_cast<cursor*>(cur);
+			return SQLITE_OK;
+		}
+
+		static int filter(sqlite3_vtab_cursor* cur, int idx_num, const char*, int argc, sqlite3_value** argv)
+		{
+			cursor* c = static_cast<cursor*>(cur);
+			const registration& reg = static_cast<table*>(cur->pVtab)->reg;
+			if (idx_num == 1 && argc == 1){
+				try {
+					std::tie(c->current, c->last) = equal_rows(*reg.rel, reg.sorted_column, argv[0], std::make_index_sequence<column_count>{});
+				}
+				catch (const std::exception& e) {
+					cur->pVtab->zErrMsg = sqlite3_mprintf("%s", e.what());
+					return SQLITE_ERROR;
+				}
+				catch (...) {
+					cur->pVtab->zErrMsg = sqlite3_mprintf("%s", "unknown exception");
+					return SQLITE_ERROR;
+				}
+				c->rowid = static_cast<sqlite3_int64>(std::distance(reg.rel->begin(), c->current));
+			}
+			else{
+				c->current = reg.rel->begin();
+				c->last = reg.rel->end();
+				c->rowid = 0;
+			}
+			return SQLITE_OK;
+		}
+
+		static int next(sqlite3_vtab_cursor* cur)
+		{
+			cursor* c = static_cast<cursor*>(cur);
+			++c->current;
+			++c->rowid;
+			return SQLITE_OK;
+		}
+
+		static int eof(sqlite3_vtab_cursor* cur)
+		{
+			cursor* c = static_cast<cursor*>(cur);
+			return (c->current == c->last);
+		}
+
+		static int column(sqlite3_vtab_cursor* cur, sqlite3_context* context, int col)
+		{
+			cursor* c = static_cast<cursor*>(cur);
+			if (col < 0 || col >= static_cast<int>(column_count)){
+				sqlite3_result_null(context);
+				return SQLITE_OK;
+			}
+			column_result(context, *static_cast<table*>(cur->pVtab)->reg.rel, *c, col, std::make_index_sequence<column_count>{});
+			return SQLITE_OK;
+		}
+
+		static int rowid(sqlite3_vtab_cursor* cur, sqlite3_int64* id)
+		{
+			*id = static_cast<cursor*>(cur)->rowid;
+			return SQLITE_OK;
+		}
+
+		static sqlite3_module make_module()
+		{
+			sqlite3_module mod{};
+			mod.iVersion = 0;
+			//no xCreate makes the table eponymous only, xUpdate left out makes it read only
+			mod.xCreate = nullptr;
+			mod.xConnect = &connect;
+			mod.xBestIndex = &best_index;
+			mod.xDisconnect = &disconnect;
+			mod.xDestroy = &disconnect;
+			mod.xOpen = &open;
+			mod.xClose = &close;
+			mod.xFilter = &filter;
+			mod.xNext = &next;
+			mod.xEof = &eof;
+			mod.xColumn = &column;
+			mod.xRowid = &rowid;
+			return mod;
+		}
+	};
+};
@@ -1,5 +1,6 @@
 #pragma once
 #include <tuple>
+#include <string_view>
 #include <fmt/format.h>
 #include <SQLite/sqlite3.h>
 
@@ -34,20 +35,49 @@ namespace nl
 		template<typename T>
 		class is_database_type
 		{
-			using special_types = std::tuple<std::string, blob_t, nullptr_t, date_time_t, uuid>;
+			using special_types = std::tuple<std::string, blob_t, nullptr_t, date_time_t, uuid, std::string_view, blob_view, zeroblob>;
 		public:
 			enum {value = (std::is_integral_v<T> || std::is_floating_point_v<T> || std::is_enum_v<T> || index_of<special_types, T>::value >= 0) };
 		};
 
-		
+		//string_view and blob_view columns are retrived without a copy, they point into the statement's row
+		//and are only valid until the next step, so rows that have them can be streamed but not stored in a relation
+		template<typename T>
+		struct is_view_type : std::bool_constant<std::is_same_v<T, std::string_view> || std::is_same_v<T, blob_view>> {};
+
+		template<typename tuple_t>
+		struct has_view_column : std::false_type {};
+
+		template<typename... T>
+		struct has_view_column<std::tuple<T...>> : std::bool_constant<(is_view_type<std::decay_t<T>>::value || ...)> {};
+
+		template<typename tuple_t>
+		constexpr bool has_view_column_v = has_view_column<tuple_t>::value;
+
+		//how text, blob and uuid columns are handed to sqlite
+		//copy: sqlite makes its own copy (SQLITE_TRANSIENT), safe when the tuple is a temporary
+		//reference: sqlite reads straight from the tuple (SQLITE_STATIC), no copies, the tuple must stay alive until the statement is stepped
+		enum class bind_mode
+		{
+			copy,
+			reference
+		};
+
+		template<bind_mode mode>
+		inline sqlite3_destructor_type bind_destructor()
+		{
+			return (mode == bind_mode::reference) ? SQLITE_STATIC : SQLITE_TRANSIENT;
+		}
+
 		//for SQL with ? instead of a parameter
-		template<size_t count, typename database_stmt, typename tuple_t>
-		inline bool handle_bind(database_stmt statement, const tuple_t& tuple)
+		//offset shifts the positions, used by multi-row VALUES statements where row n starts at n * column count
+		template<size_t count, bind_mode mode = bind_mode::copy, typename database_stmt, typename tuple_t>
+		inline bool handle_bind(database_stmt statement, const tuple_t& tuple, size_t offset = 0)
 		{
 			//col_id is the value in the tuple
 			//sqlite wants positional parameters to start from 1 not 0 so add on to col_id to get its pos
 			constexpr size_t col_id = (std::tuple_size_v<tuple_t> - (count + 1));
-			constexpr size_t position = col_id + 1;
+			const int position = static_cast<int>(offset + col_id + 1);
 			using arg_type = std::decay_t<std::tuple_element_t<col_id, tuple_t>>;
 			static_assert(is_database_type<arg_type>::value, "Tuple type is not a valid database type");	
 			if constexpr (std::is_integral_v<arg_type>)
@@ -68,28 +98,34 @@ namespace nl
 				return (SQLITE_OK == sqlite3_bind_double(statement, position, std::get<col_id>(tuple)));
 			}
 			//need to add support for other string formats
-			else if constexpr (std::is_same_v<arg_type, std::string>)
+			else if constexpr (std::is_same_v<arg_type, std::string> || std::is_same_v<arg_type, std::string_view>)
 			{
-				const std::string value = std::get<col_id>(tuple);
+				const auto& value = std::get<col_id>(tuple);
 				if (!value.empty())
 				{
-					return (SQLITE_OK == sqlite3_bind_text(statement, position, value.c_str(), value.size(), SQLITE_TRANSIENT));
+					return (SQLITE_OK == sqlite3_bind_text(statement, position, value.data(), value.size(), bind_destructor<mode>()));
 				}
+				//same as bind_para, empty strings are null, every position in a multi-row statement must be bound
+				return (SQLITE_OK == sqlite3_bind_null(statement, position));
 			}
-			else if constexpr (std::is_same_v<arg_type, blob_t>)
+			else if constexpr (std::is_same_v<arg_type, blob_t> || std::is_same_v<arg_type, blob_view>)
 			{
-				auto vec = std::get<col_id>(tuple);
+				const auto& vec = std::get<col_id>(tuple);
 				if (vec.empty())
 				{
 					//write null??? or just leave it so that, we would just bind null on empty vector
 					return (SQLITE_OK == sqlite3_bind_null(statement, position));
 				}
-				return (SQLITE_OK == sqlite3_bind_blob(statement, position, vec.data(), vec.size(), SQLITE_TRANSIENT));
+				return (SQLITE_OK == sqlite3_bind_blob(statement, position, vec.data(), vec.size(), bind_destructor<mode>()));
 			}
 			else if constexpr (std::is_null_pointer<arg_type>::value)
 			{
 				return (SQLITE_OK == sqlite3_bind_null(statement, position));
 			}
+			else if constexpr (std::is_same_v<arg_type, zeroblob>)
+			{
+				return (SQLITE_OK == sqlite3_bind_zeroblob64(statement, position, std::get<col_id>(tuple).size));
+			}
 			else if constexpr (std::is_same_v<arg_type, date_time_t>)
 			{
 				auto rep = nl::to_representation(std::get<col_id>(tuple));
@@ -97,8 +133,8 @@ namespace nl
 			}
 			else if constexpr (std::is_same_v<arg_type, uuid>)
 			{
-				auto blob = std::get<col_id>(tuple).to_blob();
-				return (SQLITE_OK == sqlite3_bind_blob(statement, position, blob.data(), blob.size(), SQLITE_TRANSIENT));
+				const nl::uuid& id = std::get<col_id>(tuple);
+				return (SQLITE_OK == sqlite3_bind_blob(statement, position, id.begin(), id.size(), bind_destructor<mode>()));
 			}
 			else if constexpr (std::is_enum_v<arg_type>) {
 				auto en = static_cast<std::uint32_t>(std::get<col_id>(tuple));
@@ -111,7 +147,7 @@ namespace nl
 
 		}
 
-		template<size_t count,typename database_stmt_t, typename tuple_t, typename para_array_t>
+		template<size_t count, bind_mode mode = bind_mode::copy, typename database_stmt_t, typename tuple_t, typename para_array_t>
 		inline bool handle_bind_para(database_stmt_t statement, const tuple_t& tuple, const para_array_t& array)
 		{
 			constexpr size_t col_id = std::tuple_size_v<tuple_t> - (count + 1);
@@ -149,29 +185,33 @@ namespace nl
 				return (SQLITE_OK == sqlite3_bind_double(statement, position, std::get<col_id>(tuple)));
 			}
 			//need to add support for other string formats
-			else if constexpr (std::is_same_v<arg_type, std::string>)
+			else if constexpr (std::is_same_v<arg_type, std::string> || std::is_same_v<arg_type, std::string_view>)
 			{
-				const std::string value = std::get<col_id>(tuple);
+				const auto& value = std::get<col_id>(tuple);
 				if (!value.empty())
 				{
-					return (SQLITE_OK == sqlite3_bind_text(statement, position, value.c_str(), value.size(), SQLITE_TRANSIENT));
+					return (SQLITE_OK == sqlite3_bind_text(statement, position, value.data(), value.size(), bind_destructor<mode>()));
 				}
 				return (SQLITE_OK == sqlite3_bind_null(statement, position));
 			}
-			else if constexpr (std::is_same_v<arg_type, blob_t>)
+			else if constexpr (std::is_same_v<arg_type, blob_t> || std::is_same_v<arg_type, blob_view>)
 			{
-				auto vec = std::get<col_id>(tuple);
+				const auto& vec = std::get<col_id>(tuple);
 				if (vec.empty())
 				{
 					//write null??? or just leave it so that, we would just bind null on empty vector
 					return (SQLITE_OK == sqlite3_bind_null(statement, position));
 				}
-				return (SQLITE_OK == sqlite3_bind_blob(statement, position, vec.data(), vec.size(), SQLITE_TRANSIENT));
+				return (SQLITE_OK == sqlite3_bind_blob(statement, position, vec.data(), vec.size(), bind_destructor<mode>()));
 			}
 			else if constexpr (std::is_null_pointer<arg_type>::value)
 			{
 				return (SQLITE_OK == sqlite3_bind_null(statement, position));
 			}
+			else if constexpr (std::is_same_v<arg_type, zeroblob>)
+			{
+				return (SQLITE_OK == sqlite3_bind_zeroblob64(statement, position, std::get<col_id>(tuple).size));
+			}
 			else if constexpr (std::is_same_v<arg_type, date_time_t>)
 			{
 				auto rep = nl::to_representation(std::get<col_id>(tuple));
@@ -179,8 +219,8 @@ namespace nl
 			}
 			else if constexpr (std::is_same_v<arg_type, uuid>)
 			{
-				auto uuid = std::get<col_id>(tuple);
-				return (SQLITE_OK == sqlite3_bind_blob(statement, position, &uuid, uuid.size(), SQLITE_TRANSIENT));
+				const nl::uuid& id = std::get<col_id>(tuple);
+				return (SQLITE_OK == sqlite3_bind_blob(statement, position, id.begin(), id.size(), bind_destructor<mode>()));
 			}
 			else if constexpr (std::is_enum_v<arg_type>) {
 				auto en = static_cast<std::uint32_t>(std::get<col_id>(tuple));
@@ -242,6 +282,25 @@ namespace nl
 				}
 				return std::make_tuple(std::string{});
 			}
+			//no copy, the text stays in sqlite's row buffer, the bytes must be read after the text pointer
+			else if constexpr (std::is_same_v<arg_t, std::string_view>)
+			{
+				const char* txt = (const char*)(sqlite3_column_text(statement, col));
+				if (txt)
+				{
+					return std::make_tuple(std::string_view(txt, sqlite3_column_bytes(statement, col)));
+				}
+				return std::make_tuple(std::string_view{});
+			}
+			else if constexpr (std::is_same_v<arg_t, blob_view>)
+			{
+				const blob_t::value_type* val_ptr = static_cast<const blob_t::value_type*>(sqlite3_column_blob(statement, col));
+				if (val_ptr)
+				{
+					return std::make_tuple(blob_view(val_ptr, sqlite3_column_bytes(statement, col)));
+				}
+				return std::make_tuple(blob_view{});
+			}
 			else if constexpr (std::is_same_v<arg_t, date_time_t>)
 			{
 				auto rep = sqlite3_column_int64(statement, col);
@@ -277,6 +336,153 @@ namespace nl
 
 		}
 
+		//the argument and return types of a lambda, functor or function pointer, used to type sql functions
+		//generic lambdas have no single call operator, so the argument types have to be written out
+		template<typename Func>
+		struct function_traits : function_traits<decltype(&Func::operator())> {};
+
+		template<typename Ret, typename... Args>
+		struct function_traits<Ret(*)(Args...)>
+		{
+			using result_t = Ret;
+			using args_t = std::tuple<std::decay_t<Args>...>;
+		};
+
+		template<typename Class, typename Ret, typename... Args>
+		struct function_traits<Ret(Class::*)(Args...)> : function_traits<Ret(*)(Args...)> {};
+
+		template<typename Class, typename Ret, typename... Args>
+		struct function_traits<Ret(Class::*)(Args...) const> : function_traits<Ret(*)(Args...)> {};
+
+		//same mapping as handle_retrive but for the arguments of an sql function
+		//string_view and blob_view arguments point into sqlite's value and are only valid during the call
+		template<typename Arg_type>
+		inline Arg_type handle_value(sqlite3_value* value)
+		{
+			using arg_t = std::decay_t<Arg_type>;
+			static_assert(is_database_type<arg_t>::value, "Argument type is not a valid database type");
+			if constexpr (std::is_integral_v<arg_t>)
+			{
+				if constexpr (sizeof(arg_t) == sizeof(std::uint64_t))
+				{
+					return static_cast<arg_t>(sqlite3_value_int64(value));
+				}
+				return static_cast<arg_t>(sqlite3_value_int(value));
+			}
+			else if constexpr (std::is_floating_point_v<arg_t>)
+			{
+				return static_cast<arg_t>(sqlite3_value_double(value));
+			}
+			else if constexpr (std::is_same_v<arg_t, std::string> || std::is_same_v<arg_t, std::string_view>)
+			{
+				const char* txt = (const char*)(sqlite3_value_text(value));
+				if (txt)
+				{
+					return arg_t(txt, sqlite3_value_bytes(value));
+				}
+				return arg_t{};
+			}
+			else if constexpr (std::is_same_v<arg_t, blob_t> || std::is_same_v<arg_t, blob_view>)
+			{
+				const blob_t::value_type* val_ptr = static_cast<const blob_t::value_type*>(sqlite3_value_blob(value));
+				if (val_ptr)
+				{
+					const size_t size = sqlite3_value_bytes(value);
+					if constexpr (std::is_same_v<arg_t, blob_t>)
+					{
+						return blob_t(val_ptr, val_ptr + size);
+					}
+					else
+					{
+						return blob_view(val_ptr, size);
+					}
+				}
+				return arg_t{};
+			}
+			else if constexpr (std::is_same_v<arg_t, date_time_t>)
+			{
+				return from_representation((clock::duration::rep)sqlite3_value_int64(value));
+			}
+			else if constexpr (std::is_same_v<arg_t, uuid>)
+			{
+				const blob_t::value_type* val_ptr = static_cast<const blob_t::value_type*>(sqlite3_value_blob(value));
+				if (val_ptr && sqlite3_value_bytes(value) == 16)
+				{
+					nl::uuid id;
+					std::copy(val_ptr, val_ptr + 16, id.begin());
+					return id;
+				}
+				return nl::uuid(boost::uuids::nil_uuid());
+			}
+			else if constexpr (std::is_enum_v<arg_t>)
+			{
+				return static_cast<arg_t>(sqlite3_value_int(value));
+			}
+			else
+			{
+				return arg_t{};
+			}
+		}
+
+		//decodes values[0..] into the argument types of args_t starting at args_t element offset
+		template<typename args_t, size_t offset, size_t... I>
+		inline auto unpack_values(sqlite3_value** values, std::index_sequence<I...>)
+		{
+			return std::tuple<std::tuple_element_t<I + offset, args_t>...>(handle_value<std::tuple_element_t<I + offset, args_t>>(values[I])...);
+		}
+
+		//same mapping as handle_bind but for the result of an sql function, text and blobs are copied by sqlite
+		template<typename T>
+		inline void handle_result(sqlite3_context* context, const T& result)
+		{
+			using arg_t = std::decay_t<T>;
+			static_assert(is_database_type<arg_t>::value, "Result type is not a valid database type");
+			if constexpr (std::is_integral_v<arg_t>)
+			{
+				if constexpr (sizeof(arg_t) == sizeof(std::uint64_t))
+				{
+					sqlite3_result_int64(context, static_cast<sqlite3_int64>(result));
+				}
+				else
+				{
+					sqlite3_result_int(context, static_cast<int>(result));
+				}
+			}
+			else if constexpr (std::is_floating_point_v<arg_t>)
+			{
+				sqlite3_result_double(context, static_cast<double>(result));
+			}
+			else if constexpr (std::is_same_v<arg_t, std::string> || std::is_same_v<arg_t, std::string_view>)
+			{
+				sqlite3_result_text(context, result.data(), static_cast<int>(result.size()), SQLITE_TRANSIENT);
+			}
+			else if constexpr (std::is_same_v<arg_t, blob_t> || std::is_same_v<arg_t, blob_view>)
+			{
+				if (result.empty())
+				{
+					sqlite3_result_null(context);
+					return;
+				}
+				sqlite3_result_blob(context, result.data(), static_cast<int>(result.size()), SQLITE_TRANSIENT);
+			}
+			else if constexpr (std::is_null_pointer_v<arg_t>)
+			{
+				sqlite3_result_null(context);
+			}
+			else if constexpr (std::is_same_v<arg_t, date_time_t>)
+			{
+				sqlite3_result_int64(context, nl::to_representation(result));
+			}
+			else if constexpr (std::is_same_v<arg_t, uuid>)
+			{
+				sqlite3_result_blob(context, result.begin(), static_cast<int>(result.size()), SQLITE_TRANSIENT);
+			}
+			else if constexpr (std::is_enum_v<arg_t>)
+			{
+				sqlite3_result_int(context, static_cast<int>(result));
+			}
+		}
+
 		template<size_t count>
 		class loop
 		{
@@ -317,19 +523,19 @@ namespace nl
 				}
 			}
 
-			template<typename database_stmt, typename tuple_t>
-			static bool do_bind(database_stmt statement, const tuple_t& tuple)
+			template<bind_mode mode = bind_mode::copy, typename database_stmt, typename tuple_t>
+			static bool do_bind(database_stmt statement, const tuple_t& tuple, size_t offset = 0)
 			{
-				bool b = handle_bind<count>(statement, tuple);
-				bool b2 = loop<count - 1>::do_bind(statement, tuple);
+				bool b = handle_bind<count, mode>(statement, tuple, offset);
+				bool b2 = loop<count - 1>::template do_bind<mode>(statement, tuple, offset);
 				return (b2 && b);
 			}
 
-			template<typename database_stmt_t, typename tuple_t, typename parameter_array_t>
+			template<bind_mode mode = bind_mode::copy, typename database_stmt_t, typename tuple_t, typename parameter_array_t>
 			static bool do_bind_para(database_stmt_t statement, const tuple_t& tuple, const parameter_array_t& parray)
 			{
-				bool b = handle_bind_para<count>(statement, tuple, parray);
-				bool b2 = loop<count - 1>::do_bind_para(statement, tuple, parray);
+				bool b = handle_bind_para<count, mode>(statement, tuple, parray);
+				bool b2 = loop<count - 1>::template do_bind_para<mode>(statement, tuple, parray);
 				return (b && b2);
 			}
 
@@ -509,10 +715,10 @@ namespace nl
 			}
 
 
-			template<typename database_stmt, typename tuple_t>
-			static bool do_bind(database_stmt statement, const tuple_t& tuple)
+			template<bind_mode mode = bind_mode::copy, typename database_stmt, typename tuple_t>
+			static bool do_bind(database_stmt statement, const tuple_t& tuple, size_t offset = 0)
 			{
-				return handle_bind<0>(statement, tuple);
+				return handle_bind<0, mode>(statement, tuple, offset);
 			}
 
 			template<typename tuple_t, typename database_stmt_t>
@@ -525,10 +731,10 @@ namespace nl
 				return handle_retrive<arg_type, 0>(statement);
 			}
 
-			template<typename database_stmt_t, typename tuple_t, typename parameter_array_t>
+			template<bind_mode mode = bind_mode::copy, typename database_stmt_t, typename tuple_t, typename parameter_array_t>
 			static bool do_bind_para(database_stmt_t statement, const tuple_t& tuple, const parameter_array_t& parray)
 			{
-				return  handle_bind_para<0>(statement, tuple, parray);
+				return  handle_bind_para<0, mode>(statement, tuple, parray);
 			
 			}
 
@@ -750,6 +956,14 @@ namespace nl
 			};
 		};
 
+		//column_relation, rows are split over one vector per column
+		template<typename T>
+		struct is_columnar_relation{
+			enum {
+				value = std::is_same_v<typename T::container_tag, columnar_relation_tag>
+			};
+		};
+
 		template<typename T>
 		struct is_hash_relation
 		{
@@ -766,6 +980,19 @@ namespace nl
 			};
 		};
 
+		//vector relations can be sized up front, lists and sets cannot
+		template<typename T, typename = void>
+		struct can_reserve
+		{
+			enum { value = false };
+		};
+
+		template<typename T>
+		struct can_reserve<T, std::void_t<decltype(std::declval<T&>().reserve(size_t{}))>>
+		{
+			enum { value = true };
+		};
+
 		//get relation column type as string
 		namespace helper
 		{